@@ -0,0 +1,238 @@
+#include "Acquisition.h"
+
+/**
+ * Acquisition
+ *
+ * Measures the line sensors in the background.
+ *
+ * Date: 2024-11-20
+ *
+ */
+
+#ifdef ARDUINO
+#include <FastGPIO.h>
+#include "Hal.h"
+#include "Timer3.h"
+
+namespace Acquisition {
+    using Pololu3piPlus32U4::LineSensors;
+
+    typedef enum {
+        // waiting for the next frame to start
+        Idle,
+        // emitters on, sensor capacitors charging
+        Charging,
+        // sensors released, waiting for them to discharge
+        Measuring,
+    } Phase;
+
+    // One bit per sensor
+    static const uint8_t ALL_SENSORS = (1 << NUM_SENSORS) - 1;
+
+    static const uint16_t CHARGE_TICKS = 10 * Timer3::TICKS_PER_US;
+    static const uint16_t POLL_TICKS = LINE_SENSOR_POLL_INTERVAL * Timer3::TICKS_PER_US;
+    static const uint16_t PERIOD_TICKS = LINE_SENSOR_PERIOD * Timer3::TICKS_PER_US;
+    static const uint16_t TIMEOUT_TICKS = LINE_SENSOR_TIMEOUT * Timer3::TICKS_PER_US;
+
+    // State of the measurement, only changed by the interrupt
+    // or with interrupts disabled
+    static volatile bool running = false;
+    static Phase phase = Idle;
+    static uint16_t frameStart = 0;
+    static uint16_t measureStart = 0;
+    static uint8_t pending = 0;
+    static uint16_t raw[NUM_SENSORS];
+    static uint32_t sampledAt = 0;
+
+    // Last complete frame, in microseconds of discharge time
+    static volatile uint16_t published[NUM_SENSORS];
+    static volatile uint32_t publishedAt = 0;
+    static volatile uint8_t publishedSequence = 0;
+
+    // Sequence of the frame last handed out by readCalibrated
+    static uint8_t consumedSequence = 0;
+
+    static inline void emittersOn() {
+        FastGPIO::Pin<LineSensors::emitterPin>::setOutputHigh();
+    }
+
+    static inline void emittersOff() {
+        FastGPIO::Pin<LineSensors::emitterPin>::setInput();
+    }
+
+    // Drives all sensor lines high to charge their capacitors
+    static inline void charge() {
+        FastGPIO::Pin<LineSensors::line0Pin>::setOutputHigh();
+        FastGPIO::Pin<LineSensors::line1Pin>::setOutputHigh();
+        FastGPIO::Pin<LineSensors::line2Pin>::setOutputHigh();
+        FastGPIO::Pin<LineSensors::line3Pin>::setOutputHigh();
+        FastGPIO::Pin<LineSensors::line4Pin>::setOutputHigh();
+    }
+
+    // Lets all capacitors discharge through their sensors
+    static inline void release() {
+        FastGPIO::Pin<LineSensors::line0Pin>::setInput();
+        FastGPIO::Pin<LineSensors::line1Pin>::setInput();
+        FastGPIO::Pin<LineSensors::line2Pin>::setInput();
+        FastGPIO::Pin<LineSensors::line3Pin>::setInput();
+        FastGPIO::Pin<LineSensors::line4Pin>::setInput();
+    }
+
+    // Bit set for every sensor whose line has dropped low
+    static inline uint8_t discharged() {
+        return !FastGPIO::Pin<LineSensors::line0Pin>::isInputHigh() << 0 |
+               !FastGPIO::Pin<LineSensors::line1Pin>::isInputHigh() << 1 |
+               !FastGPIO::Pin<LineSensors::line2Pin>::isInputHigh() << 2 |
+               !FastGPIO::Pin<LineSensors::line3Pin>::isInputHigh() << 3 |
+               !FastGPIO::Pin<LineSensors::line4Pin>::isInputHigh() << 4;
+    }
+}
+
+/*
+ * Steps the measurement; OCR3A always holds the time of the next step.
+ */
+ISR(TIMER3_COMPA_vect) {
+    using namespace Acquisition;
+
+    switch (phase) {
+        case Idle: {
+            frameStart = OCR3A;
+            emittersOn();
+            charge();
+            phase = Charging;
+            OCR3A = Timer3::ahead(frameStart + CHARGE_TICKS);
+            break;
+        }
+        case Charging: {
+            measureStart = Timer3::now();
+            sampledAt = micros();
+            release();
+            pending = ALL_SENSORS;
+            phase = Measuring;
+            OCR3A = Timer3::ahead(measureStart + POLL_TICKS);
+            break;
+        }
+        case Measuring: {
+            uint16_t elapsed = (Timer3::now() - measureStart) / Timer3::TICKS_PER_US;
+            if (elapsed > LINE_SENSOR_TIMEOUT) {
+                elapsed = LINE_SENSOR_TIMEOUT;
+            }
+
+            const uint8_t done = pending & discharged();
+            for (uint8_t i = 0; i < NUM_SENSORS; i++) {
+                if (done & 1 << i) {
+                    raw[i] = elapsed;
+                }
+            }
+            pending &= ~done;
+
+            if (pending != 0 && elapsed < LINE_SENSOR_TIMEOUT) {
+                OCR3A = Timer3::ahead(OCR3A + POLL_TICKS);
+                break;
+            }
+
+            // frame complete, whatever is still charged reads as full black
+            emittersOff();
+            for (uint8_t i = 0; i < NUM_SENSORS; i++) {
+                published[i] = pending & 1 << i ? LINE_SENSOR_TIMEOUT : raw[i];
+            }
+            publishedAt = sampledAt;
+            publishedSequence++;
+            phase = Idle;
+            OCR3A = Timer3::ahead(frameStart + PERIOD_TICKS);
+            break;
+        }
+    }
+}
+
+/*
+ * Starts measuring frames in the background.
+ * Does nothing if already running.
+ */
+void Acquisition::start() {
+    if (running) {
+        return;
+    }
+    Timer3::begin();
+
+    noInterrupts();
+    phase = Idle;
+    OCR3A = Timer3::ahead(Timer3::now());
+    TIFR3 = _BV(OCF3A);
+    TIMSK3 |= _BV(OCIE3A);
+    running = true;
+    interrupts();
+}
+
+/*
+ * Stops measuring frames and turns the emitters off, so the
+ * Pololu library can use the sensors (e.g. for calibration).
+ */
+void Acquisition::stop() {
+    noInterrupts();
+    TIMSK3 &= ~_BV(OCIE3A);
+    running = false;
+    phase = Idle;
+    interrupts();
+
+    emittersOff();
+    release();
+}
+
+/*
+ * Copies the latest complete frame, calibrated to 0 - 1000,
+ * into values, and the micros() at which its sensors were
+ * released into timestamp. Starts the measurements if needed.
+ *
+ * Returns true if the frame is newer than the one returned by
+ * the previous call; nothing is written otherwise.
+ */
+bool Acquisition::readCalibrated(uint16_t values[NUM_SENSORS], uint32_t *timestamp) {
+    if (!running) {
+        start();
+        return false;
+    }
+
+    uint16_t frame[NUM_SENSORS];
+    noInterrupts();
+    const uint8_t sequence = publishedSequence;
+    const uint32_t sampled = publishedAt;
+    for (uint8_t i = 0; i < NUM_SENSORS; i++) {
+        frame[i] = published[i];
+    }
+    interrupts();
+
+    const LineSensors::CalibrationData &calibration = Hal::lineSensors.calibrationOn;
+    if (sequence == consumedSequence || !calibration.initialized) {
+        return false;
+    }
+    consumedSequence = sequence;
+    *timestamp = sampled;
+
+    // same scaling as LineSensors::readCalibrated
+    for (uint8_t i = 0; i < NUM_SENSORS; i++) {
+        const uint16_t calmin = calibration.minimum[i];
+        const uint16_t denominator = calibration.maximum[i] - calmin;
+        int32_t value = 0;
+        if (denominator != 0) {
+            value = (static_cast<int32_t>(frame[i]) - calmin) * 1000 / denominator;
+        }
+        values[i] = constrain(value, 0, 1000);
+    }
+    return true;
+}
+
+/*
+ * Timer 3 count by which the current or next frame has surely
+ * been published.
+ */
+uint16_t Acquisition::publishedBy() {
+    start();
+
+    noInterrupts();
+    // while idle, OCR3A holds the start of the next frame
+    const uint16_t begins = phase == Idle ? OCR3A : frameStart;
+    interrupts();
+    return begins + CHARGE_TICKS + TIMEOUT_TICKS + POLL_TICKS;
+}
+#endif
@@ -0,0 +1,60 @@
+#pragma once
+#include "Lab4.h"
+
+/**
+ * Acquisition
+ *
+ * Measures the line sensors in the background.
+ *
+ * The Pololu library times the RC discharge of the sensors
+ * by busy waiting for up to the full timeout. Here the same
+ * measurement is stepped by Timer 3 compare interrupts:
+ * charge the sensors, release them, then poll them every
+ * LINE_SENSOR_POLL_INTERVAL until all have discharged or
+ * LINE_SENSOR_TIMEOUT has passed. A complete frame is then
+ * published and the next one starts LINE_SENSOR_PERIOD
+ * after the previous, so the main loop never waits on the
+ * sensors.
+ *
+ * Only available on the robot.
+ *
+ * Date: 2024-11-20
+ *
+ */
+
+#ifdef ARDUINO
+namespace Acquisition {
+    /*
+     * Starts measuring frames in the background.
+     * Does nothing if already running.
+     */
+    void start();
+
+    /*
+     * Stops measuring frames and turns the emitters off, so the
+     * Pololu library can use the sensors (e.g. for calibration).
+     */
+    void stop();
+
+    /*
+     * Copies the latest complete frame, calibrated to 0 - 1000,
+     * into values, and the micros() at which its sensors were
+     * released into timestamp. Starts the measurements if needed.
+     *
+     * Returns true if the frame is newer than the one returned by
+     * the previous call; nothing is written otherwise.
+     * Never waits.
+     */
+    bool readCalibrated(uint16_t values[NUM_SENSORS], uint32_t *timestamp);
+
+    /*
+     * Timer 3 count by which the frame being measured, or the next
+     * one if none is, has surely been published: its start plus the
+     * charge time, LINE_SENSOR_TIMEOUT and one poll. Later frames
+     * are published by the same time LINE_SENSOR_PERIOD after each
+     * other, so work timed from here never falls while a frame may
+     * still be finishing. Starts the measurements if needed.
+     */
+    uint16_t publishedBy();
+}
+#endif
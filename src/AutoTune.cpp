@@ -0,0 +1,128 @@
+#include <math.h>
+
+#include "AutoTune.h"
+
+/**
+ * AutoTune
+ *
+ * Relay feedback experiment and the gains it gives.
+ *
+ * Date: 2024-11-27
+ *
+ */
+
+namespace AutoTune {
+    // Share of the ultimate gain, and integral and derivative times as
+    // shares of the ultimate period (0 for no integral), of each rule
+    typedef struct {
+        float proportional;
+        float integralTime;
+        float derivativeTime;
+    } RuleFactors;
+
+    static const RuleFactors RULES[] = {
+        {0.8f, 0.0f, 1.0f / 8}, // ZieglerNicholsPd
+        {0.6f, 4.0f, 1.0f / 8}, // ZieglerNicholsPid
+    };
+
+    // Rounds a gain to the nearest that fits in the tuning
+    static int16_t toGain(const float gain) {
+        return static_cast<int16_t>(constrain(gain + 0.5f, 0.0f, static_cast<float>(INT16_MAX)));
+    }
+}
+
+AutoTune::RelayExperiment::RelayExperiment(const int16_t relay) : relay(relay) {
+}
+
+/*
+ * Takes the error of the next frame. An oscillation runs from one
+ * switch of the relay to the right to the next one, which happen
+ * when the error rises above the hysteresis band after having been
+ * below it.
+ */
+void AutoTune::RelayExperiment::observe(const int16_t error, const uint32_t timestamp) {
+    if (this->isDone()) {
+        return;
+    }
+    if (error > this->highest) {
+        this->highest = error;
+    }
+    if (error < this->lowest) {
+        this->lowest = error;
+    }
+
+    if (error < -AUTOTUNE_HYSTERESIS) {
+        this->below = true;
+        return;
+    }
+    if (error <= AUTOTUNE_HYSTERESIS || !this->below) {
+        return;
+    }
+
+    this->below = false;
+    if (this->switches > AUTOTUNE_SETTLE) {
+        this->measured++;
+        this->periods += timestamp - this->cycleStart;
+        this->amplitudes += static_cast<uint16_t>(this->highest - this->lowest) / 2;
+    }
+    this->switches++;
+    this->cycleStart = timestamp;
+    this->highest = error;
+    this->lowest = error;
+}
+
+bool AutoTune::RelayExperiment::isDone() const {
+    return this->measured >= AUTOTUNE_CYCLES;
+}
+
+/*
+ * Means over the measured oscillations.
+ */
+AutoTune::Result AutoTune::RelayExperiment::getResult() const {
+    if (this->measured == 0) {
+        return {0, 0, this->relay};
+    }
+    return {
+        this->periods / this->measured,
+        static_cast<int16_t>(this->amplitudes / this->measured),
+        this->relay
+    };
+}
+
+/*
+ * Gains for the result by the rule. The derivative and integral
+ * gains are per frame, so the times are taken in frames of
+ * CONTROL_PERIOD. Done once, so in floating point.
+ */
+LineFollowing::Tuning AutoTune::tune(const Result &result, const LineFollowing::Tuning &tuning, const Rule rule) {
+    // an amplitude within the hysteresis would be no oscillation at all
+    const float amplitude = result.amplitude > AUTOTUNE_HYSTERESIS ? result.amplitude : AUTOTUNE_HYSTERESIS + 1;
+    const float spread = sqrtf(amplitude * amplitude - static_cast<float>(AUTOTUNE_HYSTERESIS) * AUTOTUNE_HYSTERESIS);
+    const float ultimateGain = 4 * result.relay / (static_cast<float>(M_PI) * spread);
+    const float ultimatePeriod = static_cast<float>(result.period) / CONTROL_PERIOD;
+
+    const RuleFactors &factors = RULES[rule];
+    const float proportional = factors.proportional * ultimateGain;
+
+    LineFollowing::Tuning tuned = tuning;
+    tuned.proportional = toGain(proportional * 256);
+    tuned.derivative = toGain(proportional * factors.derivativeTime * ultimatePeriod * 256);
+    tuned.integral = factors.integralTime == 0
+                         ? 0
+                         : toGain(proportional / (factors.integralTime * ultimatePeriod) * 65536);
+    return tuned;
+}
+
+LineFollowing::Tuning AutoTune::atSpeed(const LineFollowing::Tuning &tuning, const int16_t speed) {
+    LineFollowing::Tuning experiment = tuning;
+    experiment.baseSpeed = speed;
+    experiment.maxSpeed = speed;
+    return experiment;
+}
+
+/*
+ * Relay amplitude for the tuning: AUTOTUNE_RELAY % of its speed.
+ */
+int16_t AutoTune::relayFor(const LineFollowing::Tuning &tuning) {
+    return static_cast<int16_t>(static_cast<int32_t>(tuning.baseSpeed) * AUTOTUNE_RELAY / 100);
+}
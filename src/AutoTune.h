@@ -0,0 +1,117 @@
+#pragma once
+#include "Lab4.h"
+#include "LineFollowing.h"
+
+/**
+ * AutoTune
+ *
+ * Finds line following gains on the line itself, with a relay
+ * feedback experiment (Astrom and Hagglund).
+ *
+ * While LineFollower steers with its relay (see
+ * LineFollower::setRelay), the robot weaves across the line in
+ * a steady oscillation. Its period Tu and the amplitude a of the
+ * error are those of the loop at its stability limit, and the
+ * relay of amplitude h with hysteresis e gives the ultimate gain
+ *
+ *     Ku = 4h / (pi * sqrt(a^2 - e^2))
+ *
+ * the proportional gain at which the loop would oscillate on its
+ * own. The gains then come from Ku and Tu with one of the usual
+ * rules (see Rule).
+ *
+ * The loop, and so Ku and Tu, change with speed: the experiment
+ * is run at the speed the gains are wanted for.
+ *
+ * Date: 2024-11-27
+ *
+ */
+
+namespace AutoTune {
+    // How the gains are derived from the ultimate gain and period
+    typedef enum {
+        // Kp = 0.8 Ku, Td = Tu / 8; no integral, as the default gains
+        ZieglerNicholsPd,
+        // Kp = 0.6 Ku, Ti = 4 Tu, Td = Tu / 8. Not the classic
+        // Ziegler-Nichols PID rule, which has Ti = Tu / 2: the slower
+        // integral is a deliberate departure from it. The centre
+        // sensor reads the same for a few mm either side of the
+        // tape's centre, and an integral that fast hunts across that
+        // band; this one only takes out a steady offset, such as from
+        // a drifting motor
+        ZieglerNicholsPid,
+    } Rule;
+
+    // What the experiment measured
+    typedef struct {
+        uint32_t period; // of one oscillation (us)
+        int16_t amplitude; // half the error from peak to peak, position units
+        int16_t relay; // amplitude of the relay, motor speed units
+    } Result;
+
+    class RelayExperiment {
+    public:
+        /*
+         * Experiment with a relay of the given amplitude (as given
+         * to LineFollower::setRelay).
+         */
+        explicit RelayExperiment(int16_t relay);
+
+        /*
+         * Takes the error of the next frame (LineFollower::getError)
+         * and the time it was sampled at (us).
+         */
+        void observe(int16_t error, uint32_t timestamp);
+
+        /*
+         * Have AUTOTUNE_CYCLES oscillations been measured, after
+         * the first AUTOTUNE_SETTLE?
+         */
+        bool isDone() const;
+
+        /*
+         * The mean period and amplitude of the measured
+         * oscillations. Only valid once done.
+         */
+        Result getResult() const;
+
+    private:
+        int16_t relay;
+
+        // Has the error gone below the hysteresis band since the
+        // relay last switched up?
+        bool below = false;
+
+        // Rising switches of the relay seen so far
+        uint8_t switches = 0;
+
+        // Start, highest and lowest error of the current oscillation
+        uint32_t cycleStart = 0;
+        int16_t highest = 0;
+        int16_t lowest = 0;
+
+        // Sums over the measured oscillations
+        uint8_t measured = 0;
+        uint32_t periods = 0;
+        uint32_t amplitudes = 0;
+    };
+
+    /*
+     * Gains for the result by the rule, in the tuning otherwise
+     * given. That should be the one the experiment ran with (see
+     * atSpeed): the gains only hold at its speeds, and the speed
+     * governor ramping between other ones changes the loop.
+     */
+    LineFollowing::Tuning tune(const Result &result, const LineFollowing::Tuning &tuning, Rule rule);
+
+    /*
+     * The tuning to run the experiment with for the speed: both its
+     * speeds set to it, as the relay steers about the base speed.
+     */
+    LineFollowing::Tuning atSpeed(const LineFollowing::Tuning &tuning, int16_t speed);
+
+    /*
+     * Relay amplitude for the tuning: AUTOTUNE_RELAY % of its speed.
+     */
+    int16_t relayFor(const LineFollowing::Tuning &tuning);
+}
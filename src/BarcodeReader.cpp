@@ -0,0 +1,231 @@
+#include "BarcodeReader.h"
+#include "Hal.h"
+#include "Profiler.h"
+
+/**
+ * BarcodeReader
+ *
+ * Reads a whole Code39 barcode while the robot follows the line.
+ *
+ * Date: 2024-11-23
+ *
+ */
+
+using namespace LineFollowing;
+using namespace Parser;
+using namespace Lab4;
+
+namespace BarcodeReader {
+    // Labels of the bars of the leading delimiter, in order
+    static const char DELIMITER_LABELS[WIDTH_CHARACTER_SIZE] = CODE39_DELIMITER_PATTERN;
+
+    // Starts the sequence on the buzzer without waiting for it
+    static void beep(const char *sequence) {
+        PROFILE(PlayNote);
+        Hal::Buzzer::play(sequence);
+    }
+}
+
+/*
+ * Creates a decoder waiting for the white before the leading
+ * delimiter. The parser is trained on that delimiter.
+ */
+BarcodeReader::Code39StreamDecoder::Code39StreamDecoder(KNNParser &parser) : parser(parser) {
+    reset();
+}
+
+/*
+ * Forgets everything read, to read a new barcode.
+ */
+void BarcodeReader::Code39StreamDecoder::reset() {
+    this->phase = LeadIn;
+    this->bars = {};
+    this->result = {};
+}
+
+/*
+ * Takes the next bar (or space) width and moves on to the next
+ * phase once the current one has all it needs.
+ */
+BarcodeReader::Code39StreamDecoder::Event BarcodeReader::Code39StreamDecoder::push(const Bar &bar) {
+    switch (this->phase) {
+        case LeadIn: {
+            // the white before the delimiter tells nothing
+            this->phase = Calibrating;
+            break;
+        }
+        case Calibrating: {
+            Bar labelled = bar;
+            labelled.type = static_cast<BarType>(DELIMITER_LABELS[this->bars.count]);
+            this->bars.add(labelled);
+            if (this->bars.isFull()) {
+                this->parser.train(&this->bars);
+                this->bars = {};
+                this->phase = Gap;
+            }
+            return {CalibrationBar, labelled.type, '\0', Decoded};
+        }
+        case Gap: {
+            if (this->result.isFull()) {
+                return fail(MaxCapacityReached);
+            }
+            this->phase = Reading;
+            break;
+        }
+        case Reading: {
+            this->bars.add(bar);
+            if (this->bars.isFull()) {
+                return decode();
+            }
+            break;
+        }
+        case Done: {
+            break;
+        }
+    }
+    return {Nothing, Null, '\0', Decoded};
+}
+
+/*
+ * Tells that no more bars will come as the line has ended.
+ */
+BarcodeReader::Code39StreamDecoder::Event BarcodeReader::Code39StreamDecoder::end() {
+    switch (this->phase) {
+        case Gap: {
+            // ran off the line before a character could have started
+            return fail(MissingEndDelimiter);
+        }
+        case Done: {
+            return {Nothing, Null, '\0', Decoded};
+        }
+        default: {
+            return fail(LineTooShort);
+        }
+    }
+}
+
+/*
+ * Has Finished or Failed been returned?
+ */
+bool BarcodeReader::Code39StreamDecoder::isDone() const {
+    return this->phase == Done;
+}
+
+/*
+ * Is the scanner inside the leading delimiter or a character? The
+ * phase moves on when the width before the first bar is pushed, so
+ * this is true from the first bar on.
+ */
+bool BarcodeReader::Code39StreamDecoder::isInCharacter() const {
+    return this->phase == Calibrating || this->phase == Reading;
+}
+
+/*
+ * Characters read so far.
+ */
+const BarcodeReader::Result &BarcodeReader::Code39StreamDecoder::getResult() const {
+    return this->result;
+}
+
+BarcodeReader::Code39StreamDecoder::Event BarcodeReader::Code39StreamDecoder::fail(const Status status) {
+    this->phase = Done;
+    return {Failed, Null, '\0', status};
+}
+
+/*
+ * Decodes the 9 bars collected, then waits for the next gap, or
+ * finishes on the closing delimiter.
+ */
+BarcodeReader::Code39StreamDecoder::Event BarcodeReader::Code39StreamDecoder::decode() {
+    const Option<char> parsed = this->parser.decode(this->bars);
+    if (KNNParser::countWide(this->bars) > CODE39_WIDE_COUNT) {
+        return fail(TooManyWideBars);
+    }
+    if (parsed.checkState() == None) {
+        return fail(InvalidValue);
+    }
+    this->bars = {};
+
+    const char symbol = parsed.getValue();
+    this->result.add(symbol);
+    if (symbol != CODE39_DELIMITER) {
+        this->phase = Gap;
+        return {Character, Null, symbol, Decoded};
+    }
+
+    // Remove last delimiter, and make it a valid c-string
+    this->result.setLast('\0');
+    this->phase = Done;
+    return {Finished, Null, symbol, Decoded};
+}
+
+/*
+ * Message shown for the status, e.g. "Line Too Short".
+ */
+const char *BarcodeReader::describe(const Status status) {
+    switch (status) {
+        case Decoded:
+            return "Decoded";
+        case LineTooShort:
+            return "Line Too Short";
+        case MissingEndDelimiter:
+            return "Missing End Delimiter";
+        case MaxCapacityReached:
+            return "Max Capacity Reached";
+        case TooManyWideBars:
+            return "Too many wide bars";
+        case InvalidValue:
+            return "Invalid Value";
+    }
+    return "";
+}
+
+/*
+ * Reads the barcode from the start of the line into result.
+ * The driver must have been started. Beeps high on every wide
+ * bar of the leading delimiter and low on every character.
+ * The driver holds its speed while a character is read.
+ *
+ * Returns Decoded, or what went wrong.
+ */
+BarcodeReader::Status BarcodeReader::read(LineFollower &driver, KNNParser &parser, const Tick tick, Result *result) {
+    // one scanner for the whole run, so what it learns about the
+    // barcode carries over from one character to the next
+    Scanner scanner;
+    Code39StreamDecoder decoder(parser);
+
+    for (;;) {
+        const Option<Bar> scannedResult = tick(scanner, driver);
+        Code39StreamDecoder::Event event = {Code39StreamDecoder::Nothing, Null, '\0', Decoded};
+        if (driver.getState() == ReachedEnd) {
+            driver.stop();
+            event = decoder.end();
+        } else if (scannedResult.checkState() == Some) {
+            event = decoder.push(scannedResult.getValue());
+            driver.setReading(decoder.isInCharacter());
+        }
+
+        switch (event.kind) {
+            case Code39StreamDecoder::CalibrationBar: {
+                if (event.type == Wide) {
+                    beep(HIGH_SEQUENCE);
+                }
+                break;
+            }
+            case Code39StreamDecoder::Character:
+            case Code39StreamDecoder::Finished: {
+                beep(LOW_SEQUENCE);
+                break;
+            }
+            default: {
+                break;
+            }
+        }
+
+        if (decoder.isDone()) {
+            driver.setReading(false);
+            *result = decoder.getResult();
+            return event.status;
+        }
+    }
+}
@@ -0,0 +1,174 @@
+#pragma once
+#include "Lab4.h"
+#include "LineFollowing.h"
+#include "Parser.h"
+#include "Scanner.h"
+
+/**
+ * BarcodeReader
+ *
+ * Reads a whole Code39 barcode while the robot follows the line:
+ * trains the parser on the leading delimiter, then decodes one
+ * character at a time until the closing delimiter.
+ *
+ * The decoding itself is done by Code39StreamDecoder, which takes
+ * one bar at a time. read() only feeds it from the scanner. Control
+ * ticks are left to the caller (see Tick), so the same reading runs
+ * on the robot and, from recorded or simulated frames, on a host.
+ *
+ * Date: 2024-11-23
+ *
+ */
+
+namespace BarcodeReader {
+    typedef enum {
+        // the whole barcode was read
+        Decoded,
+        // the line ended before a character was complete
+        LineTooShort,
+        // the line ended where a character should have started
+        MissingEndDelimiter,
+        // more than BARCODE_READER_CAPACITY characters
+        MaxCapacityReached,
+        // a character had more wide bars than Code39 allows
+        TooManyWideBars,
+        // a character's pattern is not in Code39
+        InvalidValue,
+    } Status;
+
+    // Characters read, the closing delimiter replaced by '\0'
+    typedef Lab4::Buffer<char, BARCODE_READER_CAPACITY> Result;
+
+    /*
+     * Runs one control tick: takes the next frame, if one is ready,
+     * and hands it to the driver, then to the scanner. Returns what
+     * the scanner found, if anything.
+     */
+    typedef Lab4::Option<Lab4::Bar> (*Tick)(Scanner &scanner, LineFollowing::LineFollower &driver);
+
+    /*
+     * Code39StreamDecoder
+     *
+     * Decodes a barcode from its bar widths, pushed one at a time as
+     * the scanner finds them. Keeps track itself of where in the
+     * barcode it is: the white before the leading delimiter, the 9 bars
+     * of that delimiter (which train the parser), then, for every
+     * character, the gap before it and its 9 bars, until the closing
+     * delimiter.
+     *
+     * Every push returns an Event telling what, if anything, the bar
+     * completed. Never waits and holds at most one character of bars,
+     * so bars may come from a control tick, a queue filled by an
+     * interrupt or a recorded run.
+     */
+    class Code39StreamDecoder {
+    public:
+        typedef enum {
+            // nothing was completed
+            Nothing,
+            // a bar of the leading delimiter, with the label it was trained as
+            CalibrationBar,
+            // a character other than the closing delimiter was decoded
+            Character,
+            // the closing delimiter was decoded, the result is complete
+            Finished,
+            // reading failed, see status
+            Failed,
+        } EventKind;
+
+        struct Event {
+            EventKind kind;
+            // CalibrationBar: its label
+            Lab4::BarType type;
+            // Character and Finished: the character decoded
+            char symbol;
+            // Finished and Failed: the outcome
+            Status status;
+        };
+
+        /*
+         * Creates a decoder waiting for the white before the leading
+         * delimiter. The parser is trained on that delimiter.
+         */
+        explicit Code39StreamDecoder(Parser::KNNParser &parser);
+
+        /*
+         * Forgets everything read, to read a new barcode.
+         */
+        void reset();
+
+        /*
+         * Takes the next bar (or space) width. Once Finished or Failed
+         * was returned, ignores bars until reset().
+         */
+        Event push(const Lab4::Bar &bar);
+
+        /*
+         * Tells that no more bars will come as the line has ended.
+         * Returns Failed with why that is too early, or Nothing if
+         * the decoder was already done.
+         */
+        Event end();
+
+        /*
+         * Has Finished or Failed been returned?
+         */
+        bool isDone() const;
+
+        /*
+         * Is the scanner between the first and last bar of the
+         * leading delimiter or of a character?
+         */
+        bool isInCharacter() const;
+
+        /*
+         * Characters read so far; once Finished, the closing delimiter
+         * is replaced by '\0'.
+         */
+        const Result &getResult() const;
+
+    private:
+        typedef enum {
+            // waiting for the white before the leading delimiter to end
+            LeadIn,
+            // collecting the bars of the leading delimiter
+            Calibrating,
+            // waiting for the gap before the next character to end
+            Gap,
+            // collecting the bars of a character
+            Reading,
+            // Finished or Failed
+            Done,
+        } Phase;
+
+        Parser::KNNParser &parser;
+        Phase phase;
+
+        // Bars of the delimiter or character being collected
+        Lab4::Buffer<Lab4::Bar, WIDTH_CHARACTER_SIZE> bars;
+
+        Result result;
+
+        // Ends reading with the status
+        Event fail(Status status);
+
+        // Decodes the complete character in bars
+        Event decode();
+    };
+
+    /*
+     * Message shown for the status, e.g. "Line Too Short".
+     */
+    const char *describe(Status status);
+
+    /*
+     * Reads the barcode from the start of the line into result.
+     * The driver must have been started. Beeps high on every wide
+     * bar of the leading delimiter and low on every character.
+     * The driver holds its speed while a character is read (see
+     * LineFollower::setReading).
+     *
+     * Returns Decoded, or what went wrong.
+     */
+    Status read(LineFollowing::LineFollower &driver, Parser::KNNParser &parser, Tick tick, Result *result);
+}
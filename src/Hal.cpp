@@ -0,0 +1,78 @@
+#include "Hal.h"
+
+/**
+ * Hal
+ *
+ * Storage for the hardware objects used by the target board.
+ *
+ * Date: 2024-11-18
+ *
+ */
+
+#ifdef ARDUINO
+namespace Hal {
+    Pololu3piPlus32U4::LineSensors lineSensors;
+
+    // Ticker period in timer ticks
+    static uint16_t tickerPeriod = 0;
+
+    // Ticks not yet taken by Ticker::wait
+    static volatile uint8_t tickerPending = 0;
+}
+
+/*
+ * Counts one tick; OCR3B always holds the time of the next one.
+ */
+ISR(TIMER3_COMPB_vect) {
+    using namespace Hal;
+
+    if (tickerPending != UINT8_MAX) {
+        tickerPending++;
+    }
+    OCR3B = Timer3::ahead(OCR3B + tickerPeriod);
+}
+
+/*
+ * Starts ticking every periodUs microseconds (Timer 3 compare B).
+ * Restarts the count if already running.
+ *
+ * With background acquisition the ticks are timed from the sensor
+ * frames: each one comes just after a frame has surely been
+ * published, however long its sensors took to discharge. Timed
+ * from any other point, a tick could fall while a dark frame is
+ * still being measured, miss it, and find it overwritten by the
+ * next one. CONTROL_PERIOD equals LINE_SENSOR_PERIOD, so the two
+ * stay in step.
+ */
+void Hal::Pololu3piPlus::Ticker::begin(const uint16_t periodUs) {
+    Timer3::begin();
+#if LINE_SENSOR_ASYNC
+    const uint16_t first = Acquisition::publishedBy();
+#else
+    const uint16_t first = Timer3::now() + periodUs * Timer3::TICKS_PER_US;
+#endif
+
+    noInterrupts();
+    tickerPeriod = periodUs * Timer3::TICKS_PER_US;
+    tickerPending = 0;
+    OCR3B = Timer3::ahead(first);
+    TIFR3 = _BV(OCF3B);
+    TIMSK3 |= _BV(OCIE3B);
+    interrupts();
+}
+
+/*
+ * Waits for the next tick. Returns how many ticks went by since
+ * the previous call; more than 1 means some were missed.
+ */
+uint8_t Hal::Pololu3piPlus::Ticker::wait() {
+    uint8_t ticks;
+    do {
+        noInterrupts();
+        ticks = tickerPending;
+        tickerPending = 0;
+        interrupts();
+    } while (ticks == 0);
+    return ticks;
+}
+#endif
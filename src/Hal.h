@@ -0,0 +1,187 @@
+#pragma once
+#include "Lab4.h"
+
+/**
+ * Hal
+ *
+ * Hardware abstraction layer for the parts of the robot used by
+ * the scan/decode path: time, line sensor frames, motor output,
+ * wheel encoders, the buzzer, the USB serial port, the status
+ * LEDs and the EEPROM.
+ *
+ * Every board is a policy struct made of static functions, and
+ * the board in use is chosen at compile time. On the robot every
+ * call resolves straight to the Pololu library, so there is no
+ * virtual dispatch and nothing is added to the hot path. The
+ * native build uses the simulated board in host/HalNative.h,
+ * which host programs drive.
+ *
+ * Date: 2024-11-18
+ *
+ */
+
+#ifdef ARDUINO
+#include <avr/eeprom.h>
+#include <Pololu3piPlus32U4.h>
+#include "Acquisition.h"
+#include "Timer3.h"
+#else
+#include "HalNative.h"
+#endif
+
+namespace Hal {
+#ifdef ARDUINO
+    // Line sensors shared by every user of the board (see Hal.cpp)
+    extern Pololu3piPlus32U4::LineSensors lineSensors;
+
+    /*
+     * Pololu3piPlus
+     *
+     * The Pololu 3pi+ 32U4 the robot is built on.
+     */
+    struct Pololu3piPlus {
+        struct Clock {
+            // Milliseconds since the board started.
+            static uint32_t millis() {
+                return ::millis();
+            }
+
+            // Microseconds since the board started, in steps of 4, wraps
+            // around after about 71 minutes.
+            static uint32_t micros() {
+                return ::micros();
+            }
+
+            // Blocks for the given amount of milliseconds.
+            static void delay(const uint32_t ms) {
+                ::delay(ms);
+            }
+
+            // Fine counter for timing short stretches of code, counts
+            // TICKS_PER_US per microsecond and wraps around every
+            // 32.768 ms. Runs once the Ticker or Acquisition started.
+            static const uint8_t TICKS_PER_US = Timer3::TICKS_PER_US;
+
+            static uint16_t ticks() {
+                return Timer3::now();
+            }
+        };
+
+        struct Ticker {
+            // Starts ticking every periodUs microseconds (Timer 3
+            // compare B). Restarts the count if already running.
+            static void begin(uint16_t periodUs);
+
+            // Waits for the next tick. Returns how many ticks went by
+            // since the previous call; more than 1 means some were missed.
+            static uint8_t wait();
+        };
+
+        struct LineSensors {
+            // Reads the sensors once for calibration. Pauses background
+            // acquisition, which resumes on the next read.
+            static void calibrate() {
+                Acquisition::stop();
+                lineSensors.setTimeout(LINE_SENSOR_TIMEOUT);
+                lineSensors.calibrate();
+            }
+
+            // Reads one frame of calibrated (0 - 1000) values and the time
+            // (us) it was sampled at. Returns false, leaving both as they
+            // are, if no new frame is ready.
+            static bool readCalibrated(uint16_t values[NUM_SENSORS], uint32_t *timestamp) {
+#if LINE_SENSOR_ASYNC
+                return Acquisition::readCalibrated(values, timestamp);
+#else
+                *timestamp = ::micros();
+                lineSensors.readCalibrated(values);
+                return true;
+#endif
+            }
+        };
+
+        struct Motors {
+            // Commands the speed of both motors.
+            static void setSpeeds(const int16_t left, const int16_t right) {
+                Pololu3piPlus32U4::Motors::setSpeeds(left, right);
+            }
+        };
+
+        struct Encoders {
+            // Counts of the left wheel since start, wraps around
+            static int16_t getCountsLeft() {
+                return Pololu3piPlus32U4::Encoders::getCountsLeft();
+            }
+
+            // Counts of the right wheel since start, wraps around
+            static int16_t getCountsRight() {
+                return Pololu3piPlus32U4::Encoders::getCountsRight();
+            }
+        };
+
+        struct Buzzer {
+            // Starts playing a note sequence, stopping the one playing.
+            static void play(const char *sequence) {
+                Pololu3piPlus32U4::Buzzer::stopPlaying();
+                Pololu3piPlus32U4::Buzzer::play(sequence);
+            }
+
+            static bool isPlaying() {
+                return Pololu3piPlus32U4::Buzzer::isPlaying();
+            }
+        };
+
+        struct SerialPort {
+            // Bytes the USB serial port takes right now without waiting
+            static uint16_t availableForWrite() {
+                return ::Serial.availableForWrite();
+            }
+
+            // Sends bytes; never more than availableForWrite() at once.
+            static void write(const uint8_t *data, const uint16_t size) {
+                ::Serial.write(data, size);
+            }
+        };
+
+        struct Leds {
+            static void red(const bool on) {
+                Pololu3piPlus32U4::ledRed(on);
+            }
+
+            static void yellow(const bool on) {
+                Pololu3piPlus32U4::ledYellow(on);
+            }
+        };
+
+        struct Storage {
+            // Bytes of EEPROM on the ATmega32U4
+            static const uint16_t SIZE = 1024;
+
+            // Copies size bytes from address on into data.
+            static void read(const uint16_t address, void *data, const uint16_t size) {
+                eeprom_read_block(data, reinterpret_cast<const void *>(address), size);
+            }
+
+            // Writes size bytes at address on, skipping the bytes that
+            // already hold the value, as every write wears the cell.
+            static void write(const uint16_t address, const void *data, const uint16_t size) {
+                eeprom_update_block(data, reinterpret_cast<void *>(address), size);
+            }
+        };
+    };
+
+    typedef Pololu3piPlus Board;
+#else
+    typedef Native Board;
+#endif
+
+    typedef Board::Clock Clock;
+    typedef Board::Ticker Ticker;
+    typedef Board::LineSensors LineSensors;
+    typedef Board::Motors Motors;
+    typedef Board::Encoders Encoders;
+    typedef Board::Buzzer Buzzer;
+    typedef Board::SerialPort SerialPort;
+    typedef Board::Leds Leds;
+    typedef Board::Storage Storage;
+}
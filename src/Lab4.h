@@ -11,9 +11,12 @@
  *
  * - BarType: An enumeration for barcode classification (Narrow, Wide, Null).
  * - Bar: A structure representing a barcode with a timestamp and type.
+ * - SensorFrame: One timestamped sample of all IR sensors.
  * - ResultState: An enumeration to represent the presence or absence of a value.
  * - Buffer: A templated class implementing a fixed-size buffer to store
  *   elements of any type.
+ * - Ring: A templated single-producer/single-consumer queue that an
+ *   interrupt can fill while the main loop empties it.
  * - Option: A templated class for encapsulating an optional value, allowing
  *   for safe handling of potentially absent values.
  */
@@ -27,9 +30,28 @@
 #define BARCODE_SENSOR_RIGHT 4 // sensor 5
 #define BARCODE_SENSOR_LEFT 0  // sensor 1
 
-// time between each IR sample
+// Take the line position from all 5 sensors, leaving out the outer
+// ones where they see a stripe (see Sensors::detectLines), instead
+// of from the 3 central ones only
+#define LINE_POSITION_WIDE 1
+
+// RC discharge time (us) beyond which an IR sensor reads full black
 #define LINE_SENSOR_TIMEOUT 2000
 
+// Measure the IR sensors in the background (see Acquisition.h)
+// instead of busy waiting on every read
+#define LINE_SENSOR_ASYNC 1
+
+// time (us) between the starts of two background IR samples
+#define LINE_SENSOR_PERIOD 2500
+
+// time (us) between two checks of the sensors while they discharge
+#define LINE_SENSOR_POLL_INTERVAL 40
+
+// time (us) between two control ticks (see Scheduler.h), one
+// background IR sample per tick
+#define CONTROL_PERIOD LINE_SENSOR_PERIOD
+
 // Values below this will be ignored
 #define NOISE_THRESHOLD 50
 
@@ -37,12 +59,37 @@
 // be not on black line.
 #define LINE_THRESHOLD 250
 
+// The line has only ended once none of the centre sensors has seen
+// it for this far, in encoder counts over both wheels (about 7 per
+// mm), or for this many frames, whichever comes first. Until then
+// the robot carries on straight over what may be a gap or dust.
+#define END_OF_LINE_DISTANCE 210
+#define END_OF_LINE_FRAMES 160
+
 // Maximum & Minimum speed the motors will be allowed to turn.
-#define MAX_SPEED 50
+#define MAX_SPEED 100
 #define MIN_SPEED 0
 
-// Speed the motors will run when centered on the line.
-#define BASE_SPEED MAX_SPEED
+// Speed the motors will run when centered on the line, until the
+// speed governor (see SpeedGovernor.h) finds the line calm enough
+// to go faster, up to MAX_SPEED.
+#define BASE_SPEED 50
+
+// Fastest speed while a character is being read, unless BASE_SPEED
+// is faster
+#define READING_SPEED 80
+
+// Speed governor: error (in line position units) up to which the
+// line counts as calm, and from which it drives at BASE_SPEED again
+#define GOVERNOR_CALM_ERROR 150
+#define GOVERNOR_SLOW_ERROR 800
+
+// frames the line must stay calm before speeding up
+#define GOVERNOR_CALM_FRAMES 80
+
+// speed gained and lost per frame * 16
+#define GOVERNOR_ACCELERATION 2
+#define GOVERNOR_DECELERATION 16
 
 // Speed of motors while calibration
 #define CALIBRATION_SPEED 50
@@ -53,6 +100,35 @@
 // Amount of Ws and Ns required to identify a character
 #define WIDTH_CHARACTER_SIZE 9
 
+// Where the scanner takes bar widths from (see Scanner.h):
+// TimeSource for durations, EncoderSource for distances
+#define SCAN_SOURCE EncoderSource
+
+// Read both sides of the barcode on their own and merge them
+// (FusedScanner) rather than ANDing them (see Scanner.h)
+#define SCAN_FUSION 1
+
+// Amount of Ws in every code39 character
+#define CODE39_WIDE_COUNT 3
+
+// Strategy used to classify bars (see Parser::ClassifierStrategy)
+#define CLASSIFIER_STRATEGY Parser::WidestThree
+
+// Keep training the parser on every character it decodes, so the
+// Narrow/Wide model follows speed changes along the track. Every bar
+// moves its class centre by 1 / 2^PARSER_ADAPT_SHIFT of its error.
+#define PARSER_ADAPTIVE 1
+#define PARSER_ADAPT_SHIFT 3
+
+// Stream a trace of every run over USB serial (see Trace.h)
+#define TRACE_ENABLED 1
+
+// RAM (bytes) holding trace records until the USB port takes them
+#define TRACE_BUFFER_SIZE 256
+
+// Time the hot sections of the control loop (see Profiler.h); 0 compiles it out
+#define PROFILER_ENABLED 0
+
 // Amount of character barcode reader can store
 #define BARCODE_READER_CAPACITY 20
 
@@ -66,9 +142,30 @@
  * This configuration uses a default proportional constant of 1/4
  * and a derivative constant of 1, which appears to perform well at low speeds.
  * Note: Adapted from Pololu3piplus documentation.
+ *
+ * The integral and curvature feed-forward terms and the derivative
+ * filter are off by default; they can be set from the tuning menu.
  */
 #define PROPORTIONAL_CONSTANT 64 // coefficient of the P term * 256
 #define DERIVATIVE_CONSTANT 256  // coefficient of the D term * 256
+#define INTEGRAL_CONSTANT 0      // coefficient of the I term * 65536
+#define FEED_FORWARD_CONSTANT 0  // coefficient of the curvature feed-forward * 256
+#define DERIVATIVE_FILTER 0      // D low-pass time constant, 2^n frames
+#define INTEGRAL_LIMIT 100       // largest I term, in motor speed units
+
+/*
+ * Auto-tune (see AutoTune.h)
+ *
+ * The relay steers either way by a share of the target speed,
+ * switching when the line is further than the hysteresis from
+ * the centre. The first oscillations are let go by while the
+ * robot settles into the cycle.
+ */
+#define AUTOTUNE_RELAY 100        // relay output, % of the target speed
+#define AUTOTUNE_HYSTERESIS 100  // distance from the centre the relay switches at
+#define AUTOTUNE_SETTLE 2        // oscillations let go by before measuring
+#define AUTOTUNE_CYCLES 4        // oscillations measured
+#define AUTOTUNE_RULE AutoTune::ZieglerNicholsPd
 
 /*
  *
@@ -89,12 +186,30 @@ namespace Lab4 {
         Null = 'X' // In this context means it's not processed
     } BarType;
 
-    // Struct representing a barcode with a timestamp and its type.
+    // Width of a bar, in the unit of the scanner's Source (see Scanner.h).
+    // 16 bits keep the arithmetic on it short on the 8-bit AVR.
+    typedef uint16_t Width;
+
+    // Width of anything too long to measure, such as the white before the barcode
+    static const Width WIDTH_SATURATED = UINT16_MAX;
+
+    // Struct representing a barcode with its width and its type.
     typedef struct {
-        uint64_t time; // Timestamp of the barcode
+        Width time; // Width of the barcode, saturated at WIDTH_SATURATED
         mutable BarType type; // Type of the barcode (Narrow or Wide)
     } Bar;
 
+    // Struct representing one sample of the IR sensors. It is taken once
+    // per tick and handed to everything that works on sensor data.
+    typedef struct {
+        uint16_t values[NUM_SENSORS]; // Calibrated readings (0 - 1000)
+        uint32_t timestamp; // When the sensors were sampled (us)
+        uint16_t distance; // Encoder counts of both wheels summed, when read
+        int16_t countsLeft; // Encoder counts of the left wheel, when read
+        int16_t countsRight; // Encoder counts of the right wheel, when read
+        uint16_t sequence; // Number of the frame, counting up from 0
+    } SensorFrame;
+
     // Enum representing the state of an Option: Some (has value) or None (no value).
     typedef enum OptionType {
         Some,
@@ -138,6 +253,95 @@ namespace Lab4 {
         }
     };
 
+    /*
+     * Template class for a fixed-size queue with one producer and one
+     * consumer, e.g. an interrupt pushing and the main loop popping.
+     *
+     * No locks are needed: each side writes only its own index, and
+     * the indices are single bytes, which the AVR reads and writes in
+     * one instruction. Compiler barriers order the element accesses
+     * against the indices on both sides:
+     * - push reads tail before it writes the element, so the slot
+     *   is free, and writes the element before head publishes it;
+     * - pop reads head before it reads the element, so the element
+     *   is the one published, and reads it before tail frees it.
+     * The AVR does not reorder memory accesses itself, so these are
+     * all the ordering it needs; they are not enough between threads
+     * on other processors.
+     *
+     * The indices run freely and are masked into the storage, so SIZE
+     * must be a power of two, and at most 128 so a full queue can be
+     * told from an empty one.
+     *
+     * Nothing uses it yet: Acquisition still hands the latest frame
+     * over with interrupts off, and edges are still found in the main
+     * loop (see Scanner). It is there for when edge detection moves
+     * into the sampling interrupt.
+     */
+    template<typename T, uint8_t SIZE>
+    class Ring {
+        static_assert(SIZE > 0 && (SIZE & (SIZE - 1)) == 0, "Ring size must be a power of two");
+        static_assert(SIZE <= 128, "Ring size must fit the 8 bit indices");
+
+        static const uint8_t MASK = SIZE - 1;
+
+        T buffer[SIZE]{}; // Elements, at their index masked
+        volatile uint8_t head = 0; // Next to write, only changed by the producer
+        volatile uint8_t tail = 0; // Next to read, only changed by the consumer
+        volatile uint8_t lost = 0; // Pushes refused as full, saturated at 255
+
+        // Keeps the compiler from moving memory accesses across it
+        static inline void barrier() {
+            __asm__ __volatile__("" ::: "memory");
+        }
+
+    public:
+        // Producer: adds the element, or counts it as lost and returns false if full.
+        bool push(const T &val) {
+            const uint8_t at = this->head;
+            if (static_cast<uint8_t>(at - this->tail) == SIZE) {
+                if (this->lost != UINT8_MAX) {
+                    this->lost = this->lost + 1;
+                }
+                return false;
+            }
+            barrier();
+            this->buffer[at & MASK] = val;
+            barrier();
+            this->head = at + 1;
+            return true;
+        }
+
+        // Consumer: takes the oldest element into out, or returns false if empty.
+        bool pop(T *out) {
+            const uint8_t at = this->tail;
+            if (at == this->head) {
+                return false;
+            }
+            barrier();
+            *out = this->buffer[at & MASK];
+            barrier();
+            this->tail = at + 1;
+            return true;
+        }
+
+        // Either side: number of elements waiting. Only a lower bound for
+        // the consumer and an upper bound for the producer.
+        uint8_t size() const {
+            return static_cast<uint8_t>(this->head - this->tail);
+        }
+
+        // Consumer: checks if there is nothing to pop.
+        bool isEmpty() const {
+            return this->head == this->tail;
+        }
+
+        // Consumer: number of pushes refused because the queue was full.
+        uint8_t getLost() const {
+            return this->lost;
+        }
+    };
+
     // Template class representing an optional value of type T.
     template<typename T>
     class Option {
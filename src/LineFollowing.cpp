@@ -1,5 +1,6 @@
-#include <Pololu3piPlus32U4.h>
 #include "LineFollowing.h"
+#include "Hal.h"
+#include "Profiler.h"
 #include "Sensors.h"
 
 /**
@@ -25,19 +26,28 @@ using namespace LineFollowing;
  * used PID controller for moving the robot
  *
  */
-void LineFollower::followLine() {
-    // Get the position of the line.
-    static int16_t lastError = 0;
+void LineFollower::followLine(const Lab4::SensorFrame &frame) {
+    PROFILE(FollowLine);
     // Get IR sensor results
     int64_t position = 0;
+    // A frame that does not clearly see the line may be a gap
+    // rather than its end
+    if (Sensors::isLineDetected(frame)) {
+        this->lostFrames = 0;
+    } else if (this->lineEnded(frame)) {
+        this->setSpeeds(0, 0);
+        this->state = ReachedEnd;
+        return;
+    }
     // Check if a line is detected
     {
         // optionalPosition will be None if it's not detected
-        Lab4::Option<int> optionalPositon = Sensors::detectLines();
+        Lab4::Option<int> optionalPositon = Sensors::detectLines(frame);
         switch (optionalPositon.checkState()) {
             case Lab4::ResultState::None: {
-                Pololu3piPlus32U4::Motors::setSpeeds(0, 0);
-                this->state = ReachedEnd;
+                // maybe a gap: carry on straight until it is clear
+                const int16_t speed = this->relay != 0 ? this->tuning.baseSpeed : this->governor.getSpeed();
+                this->setSpeeds(speed, speed);
                 return;
             }
             case Lab4::ResultState::Some: {
@@ -48,33 +58,38 @@ void LineFollower::followLine() {
     }
     // Our "error" is how far we are away from the center of the
     // line, which corresponds to position 2000.
-    const int error = position - 2000;
-    // Get motor speed difference using PROPORTIONAL_CONSTANT and derivative
-    // PID terms (the integral term is generally not very useful
-    // for line following).
-    const int speedDifference = error * PROPORTIONAL_CONSTANT / 256 + (error - lastError) * DERIVATIVE_CONSTANT / 256;
-    lastError = error;
+    this->error = static_cast<int16_t>(position - 2000);
+    // Get motor speed difference from the PID terms and the turn
+    // the robot is already making (see Tuning), or from the relay
+    // while it is on.
+    const int speedDifference = this->relay != 0
+                                    ? this->relayStep(this->error)
+                                    : this->pid.update(2000, static_cast<int16_t>(position),
+                                                       this->curvatureFeedForward(frame));
+    // The governor picks how fast to go from how well the line is
+    // followed; the relay experiment runs at the base speed.
+    const int16_t speed = this->relay != 0 ? this->tuning.baseSpeed : this->governor.update(this->error);
     // Get individual motor speeds.  The sign of speedDifference
     // determines if the robot turns left or right.
-    int leftSpeed = BASE_SPEED + speedDifference;
-    int rightSpeed = BASE_SPEED - speedDifference;
-    // Constrain our motor speeds to be between 0 and MAX_SPEED.
-    // One motor will always be turning at MAX_SPEED, and the other
-    // will be at MAX_SPEED-|speedDifference| if that is positive,
-    // else it will be stationary.  For some applications, you
-    // might want to allow the motor speed to go negative so that
-    // it can spin in reverse.
-    leftSpeed = constrain(leftSpeed, MIN_SPEED, (int16_t)MAX_SPEED);
-    rightSpeed = constrain(rightSpeed, MIN_SPEED, (int16_t)MAX_SPEED);
-    Pololu3piPlus32U4::Motors::setSpeeds(leftSpeed, rightSpeed);
+    int leftSpeed = speed + speedDifference;
+    int rightSpeed = speed - speedDifference;
+    // Constrain our motor speeds to be between MIN_SPEED and the
+    // top speed of the tuning. The motors turn at the governor's
+    // speed plus and minus speedDifference, so a sharp turn can
+    // stop the inside motor or hold the outside one at the top
+    // speed.  For some applications, you might want to allow the
+    // motor speed to go negative so that it can spin in reverse.
+    leftSpeed = constrain(leftSpeed, MIN_SPEED, this->tuning.maxSpeed);
+    rightSpeed = constrain(rightSpeed, MIN_SPEED, this->tuning.maxSpeed);
+    this->setSpeeds(leftSpeed, rightSpeed);
 }
 
 /**
- * This should be called in a loop while the robot
- * is allowed to move
+ * This should be called with every new sensor
+ * frame while the robot is allowed to move
  *
  */
-void LineFollower::follow() {
+void LineFollower::follow(const Lab4::SensorFrame &frame) {
     switch (this->state) {
         case Initialized: {
             // do nothing
@@ -90,12 +105,12 @@ void LineFollower::follow() {
             break;
         }
         case Following: {
-            this->followLine();
+            this->followLine(frame);
             break;
         }
         case ForcedStop:
         case ReachedEnd: {
-            Pololu3piPlus32U4::Motors::setSpeeds(0, 0);
+            this->setSpeeds(0, 0);
             break;
         }
     }
@@ -111,6 +126,13 @@ void LineFollower::start() {
             break;
         }
         default: {
+            if (this->state != Following) {
+                this->pid.reset();
+                this->governor.reset();
+                this->lostFrames = 0;
+                this->turn = 0;
+                this->countsPrimed = false;
+            }
             this->state = Following;
             break;
         }
@@ -121,7 +143,7 @@ void LineFollower::start() {
  * Stops the line following algorithm
  */
 void LineFollower::stop() {
-    Pololu3piPlus32U4::Motors::setSpeeds(0, 0);
+    this->setSpeeds(0, 0);
     switch (this->state) {
         case Calibrating:
         case ReachedEnd: {
@@ -158,3 +180,156 @@ void LineFollower::calibrate() {
 LineFollowingStates LineFollower::getState() const {
     return this->state;
 }
+
+/**
+ *
+ *  Get the speeds last commanded to the motors
+ *
+ */
+int16_t LineFollower::getLeftSpeed() const {
+    return this->leftSpeed;
+}
+
+int16_t LineFollower::getRightSpeed() const {
+    return this->rightSpeed;
+}
+
+/**
+ *
+ * Commands the motors and remembers the speeds
+ *
+ */
+void LineFollower::setSpeeds(const int16_t left, const int16_t right) {
+    this->leftSpeed = left;
+    this->rightSpeed = right;
+    Hal::Motors::setSpeeds(left, right);
+}
+
+/**
+ *
+ * Takes a frame in which none of the centre sensors sees the line.
+ * The line has ended once it has been gone for END_OF_LINE_DISTANCE
+ * counts or END_OF_LINE_FRAMES frames; anything shorter is a gap
+ * or dust. The curvature feed-forward starts again after it, as
+ * the robot does not steer over a gap.
+ *
+ */
+bool LineFollower::lineEnded(const Lab4::SensorFrame &frame) {
+    const int16_t travelled = static_cast<int16_t>(frame.countsLeft + frame.countsRight);
+    if (this->lostFrames == 0) {
+        this->lostAt = travelled;
+        this->countsPrimed = false;
+    }
+    if (this->lostFrames < UINT8_MAX) {
+        this->lostFrames++;
+    }
+    const int16_t distance = static_cast<int16_t>(travelled - this->lostAt);
+    return this->lostFrames >= END_OF_LINE_FRAMES || abs(distance) >= END_OF_LINE_DISTANCE;
+}
+
+/**
+ *
+ * Feed-forward for the turn the robot is already making: on a
+ * curve the controller then does not need an error to keep
+ * turning. The turn is taken from the wheel counts since the
+ * previous frame and smoothed over about 8 frames.
+ *
+ */
+int16_t LineFollower::curvatureFeedForward(const Lab4::SensorFrame &frame) {
+    const int16_t left = static_cast<int16_t>(frame.countsLeft - this->lastCountsLeft);
+    const int16_t right = static_cast<int16_t>(frame.countsRight - this->lastCountsRight);
+    this->lastCountsLeft = frame.countsLeft;
+    this->lastCountsRight = frame.countsRight;
+    if (!this->countsPrimed) {
+        this->countsPrimed = true;
+        return 0;
+    }
+
+    this->turn += (static_cast<int32_t>(left - right) * 256 - this->turn) >> 3;
+    return static_cast<int16_t>(this->turn * this->tuning.feedForward / 65536);
+}
+
+/**
+ *
+ * Controller gains for the tuning. The speed difference may
+ * swing the full range of both motors either way.
+ *
+ */
+Pid::Gains LineFollower::gainsFor(const Tuning &tuning) {
+    return {
+        tuning.proportional, tuning.integral, tuning.derivative, static_cast<uint8_t>(tuning.derivativeFilter),
+        INTEGRAL_LIMIT, static_cast<int16_t>(2 * tuning.maxSpeed)
+    };
+}
+
+/**
+ *
+ *  Replaces the speeds and gains, e.g. to try others.
+ *  May be done while following.
+ *
+ */
+void LineFollower::setTuning(const Tuning &tuning) {
+    this->tuning = tuning;
+    this->pid.setGains(gainsFor(tuning));
+    this->governor.setLimits(limitsFor(tuning));
+}
+
+/**
+ *
+ * Speed governor limits for the tuning: from the base speed up to
+ * the fastest the motors may turn.
+ *
+ */
+SpeedGovernor::Limits LineFollower::limitsFor(const Tuning &tuning) {
+    return {tuning.baseSpeed, tuning.maxSpeed, READING_SPEED};
+}
+
+const Tuning &LineFollower::getTuning() const {
+    return this->tuning;
+}
+
+/**
+ *
+ *  Steers by +/- amplitude, to the side of the line the
+ *  robot is on, instead of with the PID. 0 goes back to the
+ *  PID, which starts again from no integral.
+ *
+ */
+void LineFollower::setRelay(const int16_t amplitude) {
+    if (amplitude == 0 && this->relay != 0) {
+        this->pid.reset();
+        this->countsPrimed = false;
+    }
+    this->relay = amplitude;
+    // kick the robot off the centre so the oscillation starts
+    this->relayOutput = amplitude;
+}
+
+/**
+ *
+ *  Holds the speed while a character is being read.
+ *
+ */
+void LineFollower::setReading(const bool reading) {
+    this->governor.hold(reading);
+}
+
+int16_t LineFollower::getError() const {
+    return this->error;
+}
+
+/**
+ *
+ * Relay output for the error. It switches side once the line is
+ * AUTOTUNE_HYSTERESIS past the centre, so noise around the
+ * centre does not make it chatter.
+ *
+ */
+int16_t LineFollower::relayStep(const int16_t error) {
+    if (error > AUTOTUNE_HYSTERESIS) {
+        this->relayOutput = this->relay;
+    } else if (error < -AUTOTUNE_HYSTERESIS) {
+        this->relayOutput = static_cast<int16_t>(-this->relay);
+    }
+    return this->relayOutput;
+}
@@ -1,4 +1,7 @@
 #pragma once
+#include "Lab4.h"
+#include "Pid.h"
+#include "SpeedGovernor.h"
 
 /**
  * LineFollower
@@ -28,19 +31,86 @@ namespace LineFollowing {
         ReachedEnd,
     } LineFollowingStates;
 
+    // Speeds and gains of the line following controller
+    typedef struct {
+        int16_t baseSpeed; // speed of both motors when on the line, before speeding up
+        int16_t maxSpeed; // fastest either motor may turn, and top speed on a calm line
+        int16_t proportional; // coefficient of the P term * 256
+        int16_t derivative; // coefficient of the D term * 256
+        int16_t integral; // coefficient of the I term * 65536
+        int16_t feedForward; // coefficient of the curvature feed-forward * 256
+        int16_t derivativeFilter; // D low-pass time constant, 2^n frames
+    } Tuning;
+
+    // Tuning set in Lab4.h
+    constexpr Tuning DEFAULT_TUNING = {
+        BASE_SPEED, MAX_SPEED, PROPORTIONAL_CONSTANT, DERIVATIVE_CONSTANT,
+        INTEGRAL_CONSTANT, FEED_FORWARD_CONSTANT, DERIVATIVE_FILTER
+    };
+
     class LineFollower {
         // Tracks the state of Line Follower
         LineFollowingStates state = Initialized;
 
-        void followLine();
+        Tuning tuning = DEFAULT_TUNING;
+
+        // Steers from the distance to the centre of the line
+        Pid pid = Pid(gainsFor(DEFAULT_TUNING));
+
+        // Speed along the line, from how well it is followed
+        SpeedGovernor governor = SpeedGovernor(limitsFor(DEFAULT_TUNING));
+
+        // Turn the robot is making, from the wheel counts: the left
+        // minus the right wheel's counts per frame * 256, low-pass filtered
+        int32_t turn = 0;
+        int16_t lastCountsLeft = 0;
+        int16_t lastCountsRight = 0;
+        bool countsPrimed = false;
+
+        // Last speeds commanded to the motors
+        int16_t leftSpeed = 0;
+        int16_t rightSpeed = 0;
+
+        // Distance of the line from the centre in the last frame
+        int16_t error = 0;
+
+        // Frames in a row without the line, and the wheel counts
+        // (see EncoderSource) where it was last seen
+        uint8_t lostFrames = 0;
+        int16_t lostAt = 0;
+
+        // Amplitude of the relay steering instead of the PID (see
+        // setRelay), 0 when off, and the side it last steered to
+        int16_t relay = 0;
+        int16_t relayOutput = 0;
+
+        void followLine(const Lab4::SensorFrame &frame);
+
+        void setSpeeds(int16_t left, int16_t right);
+
+        // Relay output for the error, switching with hysteresis
+        int16_t relayStep(int16_t error);
+
+        // Takes a frame without the line; true once it has been gone
+        // long enough for the line to have ended
+        bool lineEnded(const Lab4::SensorFrame &frame);
+
+        // Feed-forward for the turn the robot is making, in motor speed units
+        int16_t curvatureFeedForward(const Lab4::SensorFrame &frame);
+
+        // Controller gains for the tuning
+        static Pid::Gains gainsFor(const Tuning &tuning);
+
+        // Speed governor limits for the tuning
+        static SpeedGovernor::Limits limitsFor(const Tuning &tuning);
 
     public:
         /**
-         * This should be called in a loop while the robot
-         * is allowed to move
+         * This should be called with every new sensor
+         * frame while the robot is allowed to move
          *
          */
-        void follow();
+        void follow(const Lab4::SensorFrame &frame);
 
         /**
          * Starts the line following algorithm
@@ -63,5 +133,49 @@ namespace LineFollowing {
          *
          */
         LineFollowingStates getState() const;
+
+        /**
+         *
+         *  Get the speeds last commanded to the motors
+         *
+         */
+        int16_t getLeftSpeed() const;
+
+        int16_t getRightSpeed() const;
+
+        /**
+         *
+         *  Replaces the speeds and gains, e.g. to try others
+         *
+         */
+        void setTuning(const Tuning &tuning);
+
+        const Tuning &getTuning() const;
+
+        /**
+         *
+         *  Steers by +/- amplitude, to the side of the line the
+         *  robot is on, instead of with the PID, for a relay
+         *  experiment (see AutoTune.h). 0 goes back to the PID.
+         *
+         */
+        void setRelay(int16_t amplitude);
+
+        /**
+         *
+         *  Tells whether a character is being read. While it is, the
+         *  speed is held, capped at READING_SPEED, so that all its
+         *  bars are crossed at the same speed (see SpeedGovernor.h).
+         *
+         */
+        void setReading(bool reading);
+
+        /**
+         *
+         *  Distance of the line from the centre in the last frame,
+         *  positive when the line is to the right
+         *
+         */
+        int16_t getError() const;
     };
 }
@@ -1,5 +1,6 @@
 #include "Parser.h"
 #include "Arduino.h"
+#include "Profiler.h"
 #include "code39.h"
 
 /**
@@ -15,22 +16,149 @@
 
 using namespace Parser;
 
+namespace {
+    // Number of distinct Narrow/Wide patterns of one character
+    constexpr int CODE39_PATTERN_COUNT = 1 << WIDTH_CHARACTER_SIZE;
+
+    /*
+     * Code39 characters indexed by their pattern key (see KNNParser::patternKey).
+     * Patterns that are not part of Code39 map to '\0'.
+     */
+    struct Code39Table {
+        char symbols[CODE39_PATTERN_COUNT];
+    };
+
+    /*
+     * Builds the pattern key lookup table from code39.h at compile time.
+     */
+    constexpr Code39Table buildCode39Table() {
+        Code39Table table = {};
+        for (const auto &row: code39) {
+            uint16_t key = 0;
+            for (int i = 1; i <= WIDTH_CHARACTER_SIZE; i++) {
+                key = static_cast<uint16_t>(key << 1 | (row[i] == Lab4::BarType::Wide));
+            }
+            table.symbols[key] = row[0];
+        }
+        return table;
+    }
+
+    // Kept in flash; only read through pgm_read_byte
+    constexpr Code39Table code39Table PROGMEM = buildCode39Table();
+
+    // Fixed point unit of a bar's share of its character (Normalised).
+    // A narrow bar is about 19 units, a wide one 46, and a width times
+    // this still fits in 32 bits.
+    constexpr uint32_t SHARE_SCALE = 1UL << 8;
+}
+
+/*
+ * Creates a parser that classifies bars with the given strategy.
+ */
+KNNParser::KNNParser(const ClassifierStrategy strategy) : strategy(strategy) {
+}
+
+/*
+ * Selects the strategy used by getBarType. Both are trained by train().
+ */
+void KNNParser::setStrategy(const ClassifierStrategy strategy) {
+    this->strategy = strategy;
+}
+
 /*
 * Trains the KNN model using 9 labeled barcode width values from a calibration batch.
+* Also computes the decision boundary used by the Threshold strategy.
 */
 void KNNParser::train(const Lab4::Buffer<Lab4::Bar,WIDTH_CHARACTER_SIZE> *calibrationBatch) {
+    uint32_t narrowTotal = 0;
+    uint32_t wideTotal = 0;
+    uint8_t narrowCount = 0;
+    uint8_t wideCount = 0;
+
     for (int i = 0; i < WIDTH_CHARACTER_SIZE; i++) {
         this->trainingData[i].type = calibrationBatch->buffer[i].type;
         this->trainingData[i].time = calibrationBatch->buffer[i].time;
         this->points[i].bar = &trainingData[i];
+
+        if (trainingData[i].type == Lab4::BarType::Wide) {
+            wideTotal += trainingData[i].time;
+            wideCount++;
+        } else {
+            narrowTotal += trainingData[i].time;
+            narrowCount++;
+        }
     }
+
+    // cluster centres, the boundary sits halfway between them
+    this->narrowCentre = narrowCount == 0 ? 0 : static_cast<Lab4::Width>(narrowTotal / narrowCount);
+    this->wideCentre = wideCount == 0 ? this->narrowCentre : static_cast<Lab4::Width>(wideTotal / wideCount);
+    this->boundary = static_cast<Lab4::Width>((static_cast<uint32_t>(this->narrowCentre) + this->wideCentre) / 2);
+
+    // the same midpoint, as a share of the whole training character
+    const uint32_t total = narrowTotal + wideTotal;
+    this->shareBoundary = total == 0 ? 0 : static_cast<uint16_t>(this->boundary * SHARE_SCALE / total);
+}
+
+/*
+ * Turns adapt() on or off for the characters decode() reads.
+ */
+void KNNParser::setAdaptive(const bool adaptive) {
+    this->adaptive = adaptive;
+}
+
+/*
+ * Moves the Narrow and Wide centres, and the KNN training bars with
+ * them, towards the widths of one decoded character. Shifts and adds
+ * only: a few cycles per bar.
+ */
+void KNNParser::adapt(const Lab4::Buffer<Lab4::Bar,WIDTH_CHARACTER_SIZE> &bars) {
+    const Lab4::Width narrowBefore = this->narrowCentre;
+    const Lab4::Width wideBefore = this->wideCentre;
+
+    for (const auto &bar: bars.buffer) {
+        Lab4::Width &centre = bar.type == Lab4::BarType::Wide ? this->wideCentre : this->narrowCentre;
+        // at most half the centre either way, so it stays within 0 - WIDTH_SATURATED
+        const int32_t bound = centre / 2;
+        int32_t error = static_cast<int32_t>(bar.time) - centre;
+        if (error > bound) {
+            error = bound;
+        } else if (error < -bound) {
+            error = -bound;
+        }
+        centre = static_cast<Lab4::Width>(centre + error / (1 << PARSER_ADAPT_SHIFT));
+    }
+
+    // the training bars follow their centre, keeping their spread
+    const int32_t narrowMoved = static_cast<int32_t>(this->narrowCentre) - narrowBefore;
+    const int32_t wideMoved = static_cast<int32_t>(this->wideCentre) - wideBefore;
+    for (auto &bar: this->trainingData) {
+        int32_t moved = static_cast<int32_t>(bar.time) + (bar.type == Lab4::BarType::Wide ? wideMoved : narrowMoved);
+        if (moved < 0) {
+            moved = 0;
+        } else if (moved > Lab4::WIDTH_SATURATED) {
+            moved = Lab4::WIDTH_SATURATED;
+        }
+        bar.time = static_cast<Lab4::Width>(moved);
+    }
+    this->boundary = static_cast<Lab4::Width>((static_cast<uint32_t>(this->narrowCentre) + this->wideCentre) / 2);
 }
 
 /*
  * Predicts whether a given barcode width is Narrow or Wide based on calibration data.
  */
 Lab4::BarType KNNParser::getBarType(const Lab4::Bar *bar) {
-    return KNearestClassifier(bar, 3, this->points);
+    PROFILE(GetBarType);
+    switch (this->strategy) {
+        case KNearestNeighbour: {
+            return KNearestClassifier(bar, 3, this->points);
+        }
+        case Threshold:
+        case WidestThree:
+        case Normalised:
+        default: {
+            return bar->time > this->boundary ? Lab4::BarType::Wide : Lab4::BarType::Narrow;
+        }
+    }
 }
 
 /*
@@ -38,14 +166,133 @@ Lab4::BarType KNNParser::getBarType(const Lab4::Bar *bar) {
  * Returns an Option<char>; empty if the sequence does not conform to Code39 specifications.
  */
 Lab4::Option<char> KNNParser::lex(const Lab4::Buffer<Lab4::BarType,WIDTH_CHARACTER_SIZE> &code) {
-    for (auto i: code39) {
-        // Set string length in code39.h is 9 excluding the first character
-        if (strncmp(reinterpret_cast<const char *>(code.buffer), i + 1, WIDTH_CHARACTER_SIZE) == 0) {
-            return Lab4::Option<char>(i[0]);
+    PROFILE(Lex);
+    const int16_t key = patternKey(code);
+    if (key < 0) {
+        return {};
+    }
+
+    const char symbol = static_cast<char>(pgm_read_byte(&code39Table.symbols[key]));
+    if (symbol == '\0') {
+        return {};
+    }
+
+    return Lab4::Option<char>(symbol);
+}
+
+/*
+ * Classifies the 9 raw widths of one character with the selected strategy,
+ * storing the result in the type of each bar, and decodes them with lex().
+ * Returns an Option<char>; empty if the result does not conform to Code39 specifications.
+ */
+Lab4::Option<char> KNNParser::decode(const Lab4::Buffer<Lab4::Bar,WIDTH_CHARACTER_SIZE> &bars) {
+    if (this->strategy == WidestThree) {
+        markWidestThree(bars);
+    } else if (this->strategy == Normalised) {
+        markByShare(bars);
+    } else {
+        for (const auto &bar: bars.buffer) {
+            bar.type = getBarType(&bar);
+        }
+    }
+
+    Lab4::Buffer<Lab4::BarType, WIDTH_CHARACTER_SIZE> code;
+    for (const auto &bar: bars.buffer) {
+        code.add(bar.type);
+    }
+    const Lab4::Option<char> symbol = lex(code);
+    if (this->adaptive && symbol.checkState() == Lab4::Some) {
+        adapt(bars);
+    }
+    return symbol;
+}
+
+/*
+ * Marks the 3 widest of the 9 bars of one character as Wide and the rest
+ * as Narrow, as every Code39 character has exactly 3 Wide elements.
+ * On ties the earlier bar wins.
+ */
+void KNNParser::markWidestThree(const Lab4::Buffer<Lab4::Bar,WIDTH_CHARACTER_SIZE> &bars) {
+    // indices of the widest bars so far, widest first
+    int8_t widest[CODE39_WIDE_COUNT];
+    uint8_t found = 0;
+
+    for (int8_t i = 0; i < WIDTH_CHARACTER_SIZE; i++) {
+        bars.buffer[i].type = Lab4::BarType::Narrow;
+
+        // insertion into the short ranking, dropping whatever falls off the end
+        int8_t j = found < CODE39_WIDE_COUNT ? found++ : CODE39_WIDE_COUNT;
+        while (j > 0 && bars.buffer[widest[j - 1]].time < bars.buffer[i].time) {
+            if (j < CODE39_WIDE_COUNT) {
+                widest[j] = widest[j - 1];
+            }
+            j--;
+        }
+        if (j < CODE39_WIDE_COUNT) {
+            widest[j] = i;
+        }
+    }
+
+    for (uint8_t i = 0; i < found; i++) {
+        bars.buffer[widest[i]].type = Lab4::BarType::Wide;
+    }
+}
+
+/*
+ * Marks each of the 9 bars of one character as Wide if its share of
+ * the character's total width is above shareBoundary, else Narrow.
+ * Compares time / total against the boundary as a product, so there
+ * is no division per bar.
+ */
+void KNNParser::markByShare(const Lab4::Buffer<Lab4::Bar,WIDTH_CHARACTER_SIZE> &bars) const {
+    uint32_t total = 0;
+    for (const auto &bar: bars.buffer) {
+        total += bar.time;
+    }
+
+    // at most 9 * 2^16 * 2^8, well within 32 bits
+    const uint32_t limit = total * this->shareBoundary;
+    for (const auto &bar: bars.buffer) {
+        bar.type = bar.time * SHARE_SCALE > limit ? Lab4::BarType::Wide : Lab4::BarType::Narrow;
+    }
+}
+
+/*
+ * Returns how many of the bars are classified as Wide.
+ */
+uint8_t KNNParser::countWide(const Lab4::Buffer<Lab4::Bar,WIDTH_CHARACTER_SIZE> &bars) {
+    uint8_t count = 0;
+    for (const auto &bar: bars.buffer) {
+        if (bar.type == Lab4::BarType::Wide) {
+            count++;
+        }
+    }
+    return count;
+}
+
+/*
+ * Packs a sequence of Narrow/Wide values into a 9 bit key, first bar in the
+ * most significant bit and Wide as 1. Returns -1 if a value is not classified.
+ */
+int16_t KNNParser::patternKey(const Lab4::Buffer<Lab4::BarType,WIDTH_CHARACTER_SIZE> &code) {
+    int16_t key = 0;
+    for (int i = 0; i < WIDTH_CHARACTER_SIZE; i++) {
+        switch (code.buffer[i]) {
+            case Lab4::BarType::Narrow: {
+                key = static_cast<int16_t>(key << 1);
+                break;
+            }
+            case Lab4::BarType::Wide: {
+                key = static_cast<int16_t>(key << 1 | 1);
+                break;
+            }
+            default: {
+                return -1;
+            }
         }
     }
 
-    return {};
+    return key;
 }
 
 
@@ -58,9 +305,9 @@ Lab4::Option<char> KNNParser::lex(const Lab4::Buffer<Lab4::BarType,WIDTH_CHARACT
 Lab4::BarType KNNParser::KNearestClassifier(const Lab4::Bar *bar, const int k, KNNPoint points[WIDTH_CHARACTER_SIZE]) {
     // calculate euclidian distance
     for (int i = 0; i < WIDTH_CHARACTER_SIZE; i++) {
-        points[i].distance = abs(
-            static_cast<int64_t>(bar->time) - static_cast<int64_t>(points[i].bar->time)
-        );
+        const Lab4::Width a = bar->time;
+        const Lab4::Width b = points[i].bar->time;
+        points[i].distance = a > b ? a - b : b - a;
     }
 
     quickSort(points, 0,WIDTH_CHARACTER_SIZE - 1);
@@ -104,7 +351,7 @@ void KNNParser::quickSort(KNNPoint arr[], int low, int high) {
  */
 int KNNParser::partition(KNNPoint arr[], int low, int high) {
     // Initialize pivot to be the first element
-    int p = arr[low].distance;
+    const Lab4::Width p = arr[low].distance;
     int i = low;
     int j = high;
 
@@ -13,6 +13,25 @@
  */
 
 namespace Parser {
+    /*
+     * Strategies KNNParser can use to classify a single bar.
+     */
+    typedef enum {
+        // Majority vote of the 3 nearest calibration bars
+        KNearestNeighbour,
+        // Single compare against the midpoint of the Narrow and Wide centres
+        Threshold,
+        // Whole character at once: its 3 widest bars are Wide, needs no
+        // calibration. Single bars are classified as with Threshold.
+        WidestThree,
+        // Whole character at once: each bar as a share of the character's
+        // total width, against the boundary between the Narrow and Wide
+        // shares of the training '*'. A steady change of speed scales all
+        // 9 bars alike, so it does not move the boundary. Single bars are
+        // classified as with Threshold.
+        Normalised,
+    } ClassifierStrategy;
+
     /*
      * KNNParser
      *
@@ -20,16 +39,49 @@ namespace Parser {
      * It trains the model with a calibration batch to accurately classify
      * barcode values as Narrow or Wide. Once calibrated, it can also predict
      * decode batches of values as code39 characters.
+     *
+     * The same training also yields a Threshold model, which replaces the
+     * distance sort and vote with a single compare per bar.
      */
 
     class KNNParser {
     public:
+        /*
+         * Creates a parser that classifies bars with the given strategy.
+         */
+        explicit KNNParser(ClassifierStrategy strategy = Threshold);
+
+        /*
+         * Selects the strategy used by getBarType. Both are trained by train().
+         */
+        void setStrategy(ClassifierStrategy strategy);
+
         /*
          * Trains the KNN model using 9 labeled barcode width values from a calibration batch.
          * Assumes the batch to be code39 character set
+         *
+         * Also computes the Narrow and Wide cluster centres and the
+         * decision boundary between them for the Threshold strategy,
+         * and the same boundary as a share of the character for Normalised.
          */
         void train(const Lab4::Buffer<Lab4::Bar, WIDTH_CHARACTER_SIZE> *calibrationBatch);
 
+        /*
+         * Turns adapt() on or off for the characters decode() reads.
+         * Starts as PARSER_ADAPTIVE.
+         */
+        void setAdaptive(bool adaptive);
+
+        /*
+         * Moves the Narrow and Wide centres, and the KNN training bars
+         * with them, towards the widths of one decoded character, whose
+         * bars must already be classified. Each bar moves its centre by
+         * 1 / 2^PARSER_ADAPT_SHIFT of its distance, bounded to half
+         * the centre, so a single bad width cannot drag the model away.
+         * decode() calls this on every character it lexes.
+         */
+        void adapt(const Lab4::Buffer<Lab4::Bar, WIDTH_CHARACTER_SIZE> &bars);
+
         /*
          * Predicts whether a given barcode width is Narrow or Wide based on calibration data.
          */
@@ -41,13 +93,68 @@ namespace Parser {
          */
         static Lab4::Option<char> lex(const Lab4::Buffer<Lab4::BarType, WIDTH_CHARACTER_SIZE> &code);
 
+        /*
+         * Classifies the 9 raw widths of one character with the selected strategy,
+         * storing the result in the type of each bar, and decodes them with lex().
+         * If they decode and adaptive is on, also adapts the model to them.
+         * Returns an Option<char>; empty if the result does not conform to Code39 specifications.
+         */
+        Lab4::Option<char> decode(const Lab4::Buffer<Lab4::Bar, WIDTH_CHARACTER_SIZE> &bars);
+
+        /*
+         * Marks the 3 widest of the 9 bars of one character as Wide and the rest
+         * as Narrow, as every Code39 character has exactly 3 Wide elements.
+         * On ties the earlier bar wins.
+         */
+        static void markWidestThree(const Lab4::Buffer<Lab4::Bar, WIDTH_CHARACTER_SIZE> &bars);
+
+        /*
+         * Marks each of the 9 bars of one character as Wide if its share of
+         * the character's total width is above shareBoundary, else Narrow.
+         */
+        void markByShare(const Lab4::Buffer<Lab4::Bar, WIDTH_CHARACTER_SIZE> &bars) const;
+
+        /*
+         * Returns how many of the bars are classified as Wide.
+         */
+        static uint8_t countWide(const Lab4::Buffer<Lab4::Bar, WIDTH_CHARACTER_SIZE> &bars);
+
+        /*
+         * Packs a sequence of Narrow/Wide values into a 9 bit key, first bar in the
+         * most significant bit and Wide as 1. Returns -1 if a value is not classified.
+         * lex() resolves the key through a table generated from code39.h.
+         */
+        static int16_t patternKey(const Lab4::Buffer<Lab4::BarType, WIDTH_CHARACTER_SIZE> &code);
+
     private:
+        // Strategy used by getBarType
+        ClassifierStrategy strategy;
+
+        // Whether decode() calls adapt()
+        bool adaptive = PARSER_ADAPTIVE;
+
+        // Mean Narrow and Wide widths, as trained and adapted since
+        Lab4::Width narrowCentre = 0;
+        Lab4::Width wideCentre = 0;
+
+        /*
+         * Widths at or below this are Narrow, above are Wide.
+         * Midpoint of the Narrow and Wide centres.
+         */
+        Lab4::Width boundary = 0;
+
+        /*
+         * Boundary of the Normalised strategy: midpoint of the Narrow and
+         * Wide shares of the training character, in 1 / SHARE_SCALE.
+         */
+        uint16_t shareBoundary = 0;
+
         /*
          * Structure representing a point in the KNN algorithm.
          * Contains the Euclidean distance and a pointer to the corresponding Bar.
          */
         struct KNNPoint {
-            int64_t distance;
+            Lab4::Width distance;
             const Lab4::Bar *bar;
         };
 
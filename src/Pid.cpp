@@ -0,0 +1,80 @@
+#include "Pid.h"
+
+/**
+ * Pid
+ *
+ * Fixed-point PID controller.
+ *
+ * Date: 2024-11-26
+ *
+ */
+
+Pid::Pid(const Gains &gains) : gains(gains) {
+}
+
+/*
+ * Replaces the gains, keeping the state.
+ */
+void Pid::setGains(const Gains &gains) {
+    this->gains = gains;
+}
+
+const Pid::Gains &Pid::getGains() const {
+    return this->gains;
+}
+
+/*
+ * Forgets the integral and the previous measurement.
+ */
+void Pid::reset() {
+    this->integral = 0;
+    this->slope = 0;
+    this->primed = false;
+}
+
+/*
+ * Takes the next measurement and returns the output.
+ */
+int16_t Pid::update(const int16_t setpoint, const int16_t measurement, const int16_t feedForward) {
+    const int32_t error = static_cast<int32_t>(measurement) - setpoint;
+
+    // derivative on the measurement, low-pass filtered; nothing to
+    // compare the very first measurement with
+    const int32_t change = this->primed ? static_cast<int32_t>(measurement) - this->lastMeasurement : 0;
+    this->lastMeasurement = measurement;
+    this->primed = true;
+    this->slope += (change * 256 - this->slope) >> this->gains.derivativeFilter;
+
+    const int32_t proportionalTerm = error * this->gains.proportional / 256;
+    const int32_t derivativeTerm = this->slope / 256 * this->gains.derivative / 256;
+
+    // the integral never holds more than integralLimit worth of output,
+    // so its product with the gain stays within 32 bits
+    int32_t integral = this->integral;
+    int32_t integralTerm = 0;
+    if (this->gains.integral != 0) {
+        const int32_t most = static_cast<int32_t>(this->gains.integralLimit) * 65536 / this->gains.integral;
+        integral = clamp(integral + error, most < 0 ? -most : most);
+        integralTerm = integral * this->gains.integral / 65536;
+    }
+
+    const int32_t output = proportionalTerm + integralTerm + derivativeTerm + feedForward;
+    const int32_t limited = clamp(output, this->gains.outputLimit);
+
+    // anti-windup: keep the integral where it was if the output is
+    // saturated and the error would only push it further
+    if (limited == output || (output > 0) != (error > 0)) {
+        this->integral = integral;
+    }
+    return static_cast<int16_t>(limited);
+}
+
+int32_t Pid::clamp(const int32_t value, const int32_t limit) {
+    if (value > limit) {
+        return limit;
+    }
+    if (value < -limit) {
+        return -limit;
+    }
+    return value;
+}
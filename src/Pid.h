@@ -0,0 +1,78 @@
+#pragma once
+#include "Lab4.h"
+
+/**
+ * Pid
+ *
+ * Fixed-point PID controller.
+ *
+ * Gains are coefficients * 256, as the rest of the controller
+ * constants in Lab4.h, except the integral one, which is * 65536
+ * as the integral of the error grows by the error every update.
+ * All state is integer, so an update is a few 16 and 32 bit
+ * multiplies on the AVR.
+ *
+ * - The derivative is taken on the measurement rather than on
+ *   the error, so moving the setpoint does not kick the output,
+ *   and it is smoothed by a first order low-pass filter whose
+ *   time constant is 2^derivativeFilter updates (0 is no
+ *   filtering).
+ * - The integral is clamped so its term never exceeds
+ *   integralLimit on its own, and does not grow while the output
+ *   is saturated in the direction the error would push it
+ *   (anti-windup).
+ * - A feed-forward value, already in output units, is added
+ *   before the output is limited.
+ *
+ * Date: 2024-11-26
+ *
+ */
+
+class Pid {
+public:
+    struct Gains {
+        int16_t proportional; // coefficient of the P term * 256
+        int16_t integral; // coefficient of the I term * 65536
+        int16_t derivative; // coefficient of the D term * 256
+        uint8_t derivativeFilter; // D low-pass time constant, as a power of 2 of updates
+        int16_t integralLimit; // largest I term, in output units
+        int16_t outputLimit; // largest output either way
+    };
+
+    explicit Pid(const Gains &gains);
+
+    /*
+     * Replaces the gains. The state is kept, so this may be
+     * done while running.
+     */
+    void setGains(const Gains &gains);
+
+    const Gains &getGains() const;
+
+    /*
+     * Forgets the integral and the previous measurement, e.g.
+     * before starting again.
+     */
+    void reset();
+
+    /*
+     * Takes the next measurement and returns the output,
+     * within +/- outputLimit. The error is measurement - setpoint.
+     */
+    int16_t update(int16_t setpoint, int16_t measurement, int16_t feedForward = 0);
+
+private:
+    Gains gains;
+
+    // Sum of the errors, in error units
+    int32_t integral = 0;
+
+    // Filtered change of the measurement per update, * 256
+    int32_t slope = 0;
+
+    int16_t lastMeasurement = 0;
+    bool primed = false;
+
+    // Limits value to +/- limit
+    static int32_t clamp(int32_t value, int32_t limit);
+};
@@ -0,0 +1,91 @@
+#include <stdio.h>
+
+#include "Profiler.h"
+#include "Trace.h"
+
+/**
+ * Profiler
+ *
+ * Counts how long the hot sections of the control loop take.
+ *
+ * Date: 2024-11-25
+ *
+ */
+
+#if PROFILER_ENABLED
+namespace Profiler {
+    static SectionStats stats[SECTION_COUNT];
+
+    static const char *const NAMES[SECTION_COUNT] = {"acq", "detect", "follow", "scan", "bartyp", "lex", "note"};
+}
+
+/*
+ * Clears the statistics of every section.
+ */
+void Profiler::reset() {
+    for (auto &section: stats) {
+        section = {0, 0, 0, 0};
+    }
+}
+
+/*
+ * Adds the time from start to now to the section. Once the count is
+ * full, the total is scaled down with it so the mean stays right.
+ */
+void Profiler::record(const Section section, const uint16_t start) {
+    const uint16_t elapsed = Hal::Clock::ticks() - start;
+    SectionStats &entry = stats[section];
+
+    if (entry.count == 0 || elapsed < entry.min) {
+        entry.min = elapsed;
+    }
+    if (elapsed > entry.max) {
+        entry.max = elapsed;
+    }
+    if (entry.count == UINT16_MAX) {
+        entry.total -= entry.total / entry.count;
+        entry.count--;
+    }
+    entry.total += elapsed;
+    entry.count++;
+}
+
+const Profiler::SectionStats &Profiler::getStats(const Section section) {
+    return stats[section];
+}
+
+/*
+ * Short name of the section, at most 6 characters.
+ */
+const char *Profiler::name(const Section section) {
+    return NAMES[section];
+}
+
+/*
+ * Converts Hal::Clock ticks to CPU cycles.
+ */
+uint32_t Profiler::toCycles(const uint32_t ticks) {
+    return ticks * CYCLES_PER_TICK;
+}
+
+/*
+ * Sends every section that ran as a trace note.
+ */
+void Profiler::dump() {
+#if TRACE_ENABLED
+    // room for the longest numbers; note() cuts the text to MAX_NOTE
+    char text[48];
+    for (uint8_t section = 0; section < SECTION_COUNT; section++) {
+        const SectionStats &entry = stats[section];
+        if (entry.count == 0) {
+            continue;
+        }
+        snprintf(text, sizeof(text), "prof %s %u %lu %lu %lu", NAMES[section], entry.count,
+                 static_cast<unsigned long>(toCycles(entry.min)),
+                 static_cast<unsigned long>(toCycles(entry.total / entry.count)),
+                 static_cast<unsigned long>(toCycles(entry.max)));
+        Trace::note(text);
+    }
+#endif
+}
+#endif
@@ -0,0 +1,110 @@
+#pragma once
+#include "Lab4.h"
+#include "Hal.h"
+
+/**
+ * Profiler
+ *
+ * Counts how long the hot sections of the control loop take.
+ *
+ * A section is timed by putting PROFILE(Section) at the top of
+ * the scope it covers: a probe reads the free-running Hal::Clock
+ * ticks (Timer 3, 8 CPU cycles a tick on the robot) when it is
+ * made and again when it goes out of scope, and adds the
+ * difference to the count, minimum, maximum and total of its
+ * section. Sections may nest; each counts everything inside it.
+ * A section must take less than 32 ms, where the ticks wrap.
+ *
+ * With PROFILER_ENABLED set to 0, PROFILE() expands to nothing
+ * and none of this is compiled in.
+ *
+ * Date: 2024-11-25
+ *
+ */
+
+#if PROFILER_ENABLED
+namespace Profiler {
+    typedef enum {
+        // Sensors::acquire, reading the calibrated sensors and encoders
+        Acquire,
+        // Sensors::detectLines
+        DetectLines,
+        // LineFollower::followLine, detectLines included
+        FollowLine,
+        // Scanner::scan, both sides when fused
+        Scan,
+        // KNNParser::getBarType
+        GetBarType,
+        // KNNParser::lex
+        Lex,
+        // starting a buzzer sequence, without waiting for it
+        PlayNote,
+        SECTION_COUNT,
+    } Section;
+
+    struct SectionStats {
+        // Times the section ran, saturated at UINT16_MAX
+        uint16_t count;
+        // Execution times, in Hal::Clock ticks
+        uint16_t min;
+        uint16_t max;
+        uint32_t total;
+    };
+
+    // CPU cycles in one Hal::Clock tick; on the host, where the clock
+    // is virtual, one tick (a microsecond) counts as one
+#ifdef ARDUINO
+    const uint8_t CYCLES_PER_TICK = F_CPU / 1000000UL / Hal::Clock::TICKS_PER_US;
+#else
+    const uint8_t CYCLES_PER_TICK = 1;
+#endif
+
+    /*
+     * Clears the statistics of every section.
+     */
+    void reset();
+
+    /*
+     * Adds the time from start (in Hal::Clock ticks) to now to the section.
+     */
+    void record(Section section, uint16_t start);
+
+    const SectionStats &getStats(Section section);
+
+    /*
+     * Short name of the section, at most 6 characters.
+     */
+    const char *name(Section section);
+
+    /*
+     * Converts Hal::Clock ticks to CPU cycles.
+     */
+    uint32_t toCycles(uint32_t ticks);
+
+    /*
+     * Sends every section that ran as a trace note (see Trace.h):
+     * "prof <name> <count> <min> <mean> <max>", times in cycles.
+     * Does nothing without TRACE_ENABLED.
+     */
+    void dump();
+
+    // Records the section it was made for when it goes out of scope
+    class Probe {
+        const Section section;
+        const uint16_t start;
+
+    public:
+        explicit Probe(const Section section) : section(section), start(Hal::Clock::ticks()) {
+        }
+
+        ~Probe() {
+            record(section, start);
+        }
+    };
+}
+
+// Times the rest of the enclosing scope as the given Profiler::Section
+#define PROFILE(section) const Profiler::Probe profilerProbe(Profiler::section)
+#else
+#define PROFILE(section)
+#endif
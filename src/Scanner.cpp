@@ -1,5 +1,7 @@
 #include "Scanner.h"
 #include "Sensors.h"
+#include "Hal.h"
+#include "Profiler.h"
 
 /**
  * Scanner
@@ -11,15 +13,43 @@
  *
  */
 
+namespace {
+    /*
+     * Bar width for the distance between two stamps, in the unit of
+     * the Source, saturated at Lab4::WIDTH_SATURATED.
+     */
+    template<typename Source>
+    Lab4::Width widthOf(const typename Source::Stamp delta) {
+        const typename Source::Stamp width = delta >> Source::WIDTH_SHIFT;
+        return width > Lab4::WIDTH_SATURATED ? Lab4::WIDTH_SATURATED : static_cast<Lab4::Width>(width);
+    }
+}
+
+/*
+ * Positions in microseconds since the board started.
+ */
+TimeSource::Stamp TimeSource::now() {
+    return Hal::Clock::micros();
+}
+
+/*
+ * Positions in encoder counts summed over both wheels.
+ */
+EncoderSource::Stamp EncoderSource::now() {
+    return static_cast<Stamp>(Hal::Encoders::getCountsLeft() + Hal::Encoders::getCountsRight());
+}
+
 /**
  *
  * Scans the barcode width from the time of
  * initialization of this object
  *
  */
-Scanner::Scanner() {
+template<typename Source>
+BasicScanner<Source>::BasicScanner(const ScanChannel channel) {
+    this->channel = channel;
     this->state = WHITE;
-    this->t0 = millis();
+    this->t0 = Source::now();
 }
 
 /**
@@ -28,24 +58,31 @@ Scanner::Scanner() {
  * startTime of initialization of this object
  *
  */
-
-Scanner::Scanner(const uint64_t startTime) {
+template<typename Source>
+BasicScanner<Source>::BasicScanner(const Stamp startTime, const ScanChannel channel) {
+    this->channel = channel;
     this->state = WHITE;
     this->t0 = startTime;
 }
 
 /**
  *
- * Scans and returns everytime a new value is detected.
+ * Scans the frame and returns everytime a new value is detected.
+ * The edge is interpolated between this frame and the previous one.
  * returns Bar {
- *  time = how long is the width of that bar
+ *  time = how long is the width of that bar (see Source::WIDTH_SHIFT)
  *  type = NULL
  *}
  * Option<Bar> will be empty if a new value is not detected.
  * It will contain a value if a new value is detected.
  *
  */
-Lab4::Option<Lab4::Bar> Scanner::scan() {
+template<typename Source>
+Lab4::Option<Lab4::Bar> BasicScanner<Source>::scan(const Lab4::SensorFrame &frame) {
+#if !SCAN_FUSION
+    // the fused scanner times both of its sides as one
+    PROFILE(Scan);
+#endif
     /*
 
         Basically everytime we are seeing a new color,
@@ -58,29 +95,278 @@ Lab4::Option<Lab4::Bar> Scanner::scan() {
 
 
      */
-    const bool blackDetected = Sensors::isBarcodeDetected();
+    uint16_t level;
+    switch (this->channel) {
+        case LeftSide: {
+            level = frame.values[BARCODE_SENSOR_LEFT];
+            break;
+        }
+        case RightSide: {
+            level = frame.values[BARCODE_SENSOR_RIGHT];
+            break;
+        }
+        default: {
+            level = Sensors::barcodeLevel(frame);
+            break;
+        }
+    }
+    const bool blackDetected = level > LINE_THRESHOLD;
+    const Stamp stamp = Source::at(frame);
+    bool changed = false;
+
     switch (this->state) {
         case WHITE: {
             if (blackDetected) {
                 this->state = BLACK;
-                const uint64_t t1 = millis();
-                const uint64_t delta = t1 - t0;
-                this->t0 = t1;
-                return Lab4::Option<Lab4::Bar>({delta, Lab4::BarType::Null});
+                changed = true;
             }
             break;
         }
         case BLACK: {
             if (!blackDetected) {
                 this->state = WHITE;
-                const uint64_t t1 = millis();
-                const uint64_t delta = t1 - t0;
-                this->t0 = t1;
-                return Lab4::Option<Lab4::Bar>({delta, Lab4::BarType::Null});
+                changed = true;
             }
             break;
         }
     }
 
+    const Stamp t1 = changed ? edgeAt(stamp, level) : stamp;
+    this->lastLevel = level;
+    this->lastStamp = stamp;
+    this->primed = true;
+
+    if (changed) {
+        const Stamp delta = t1 - t0;
+        this->t0 = t1;
+        return Lab4::Option<Lab4::Bar>({widthOf<Source>(delta), Lab4::BarType::Null});
+    }
     return {};
 }
+
+/*
+ * Position where the barcode level crossed LINE_THRESHOLD between
+ * the previous frame and this one (at `stamp` with `level`), found
+ * by linear interpolation. Falls back to `stamp` for the first frame
+ * or after a gap too long to interpolate over.
+ */
+template<typename Source>
+typename BasicScanner<Source>::Stamp BasicScanner<Source>::edgeAt(const Stamp stamp, const uint16_t level) const {
+    const Stamp span = stamp - this->lastStamp;
+    if (!this->primed || span > UINT32_MAX / 1000 || level == this->lastLevel) {
+        return stamp;
+    }
+
+    // both differences have the same sign, so the fraction is in (0, 1]
+    const int16_t toThreshold = static_cast<int16_t>(LINE_THRESHOLD) - static_cast<int16_t>(this->lastLevel);
+    const int16_t toLevel = static_cast<int16_t>(level) - static_cast<int16_t>(this->lastLevel);
+    const uint32_t offset = static_cast<uint32_t>(span) * abs(toThreshold) / abs(toLevel);
+    return this->lastStamp + static_cast<Stamp>(offset);
+}
+
+/**
+ *
+ * Position of the last edge, where the current
+ * colour started
+ *
+ */
+template<typename Source>
+typename BasicScanner<Source>::Stamp BasicScanner<Source>::lastEdge() const {
+    return this->t0;
+}
+
+/**
+ *
+ * Is the colour since the last edge black?
+ *
+ */
+template<typename Source>
+bool BasicScanner<Source>::isBlack() const {
+    return this->state == BLACK;
+}
+
+template<typename Source>
+FusedScanner<Source>::FusedScanner()
+    : sides{{BasicScanner<Source>(LeftSide), {}, 0, 0}, {BasicScanner<Source>(RightSide), {}, 0, 0}} {
+    this->merged = Source::now();
+    this->black = false;
+    this->skew = 0;
+    this->skewKnown = false;
+    this->widthCount = 0;
+    this->widthNext = 0;
+    this->started = false;
+    this->matched = 0;
+    this->lastSingle = 0;
+    this->lastSingleLeft = false;
+}
+
+/**
+ *
+ * Scans the frame with both sides and returns the
+ * next merged width once it is known. At most one
+ * width comes out per frame; any other ready edge
+ * waits for the next frame, which does not change
+ * its position.
+ *
+ */
+template<typename Source>
+Lab4::Option<Lab4::Bar> FusedScanner<Source>::scan(const Lab4::SensorFrame &frame) {
+    PROFILE(Scan);
+    Side &left = this->sides[0];
+    Side &right = this->sides[1];
+    read(left, frame);
+    read(right, frame);
+
+    const Stamp now = Source::at(frame);
+    const Offset narrowWindow = this->window();
+    const Offset half = this->skew / 2;
+
+    for (;;) {
+        const bool hasLeft = left.count > 0;
+        const bool hasRight = right.count > 0;
+        if (!hasLeft && !hasRight) {
+            return {};
+        }
+
+        // head edges moved to halfway between the sides
+        const Edge l = left.edges[0];
+        const Edge r = right.edges[0];
+        const Stamp leftAt = l.at - half;
+        const Stamp rightAt = r.at + (this->skew - half);
+
+        // until the narrow width is known, the sides must agree to
+        // within half of the element the earlier edge ends
+        Offset window = narrowWindow;
+        if (window == 0) {
+            const Stamp earliest = !hasRight || (hasLeft && static_cast<Offset>(leftAt - rightAt) < 0) ? leftAt : rightAt;
+            window = static_cast<Offset>(earliest - this->merged) / 2;
+        }
+
+        if (hasLeft && hasRight) {
+            const Offset apart = static_cast<Offset>(leftAt - rightAt);
+            const Offset distance = apart < 0 ? -apart : apart;
+            if (l.black == r.black && distance <= window) {
+                pop(left);
+                pop(right);
+                this->matched++;
+                const Offset seen = static_cast<Offset>(l.at - r.at);
+                this->skew = this->skewKnown ? this->skew + (seen - this->skew) / 4 : seen;
+                this->skewKnown = true;
+                return emit(r.at + seen / 2, l.black);
+            }
+        }
+
+        // otherwise the earlier edge goes alone once the other side is overdue
+        const bool leftFirst = hasLeft && (!hasRight || static_cast<Offset>(leftAt - rightAt) < 0);
+        Side &side = leftFirst ? left : right;
+        const Edge edge = leftFirst ? l : r;
+        const Stamp at = leftFirst ? leftAt : rightAt;
+        const bool overdue = static_cast<Offset>(now - at) > window;
+        if (!overdue) {
+            return {};
+        }
+        pop(side);
+        if (edge.black == this->black) {
+            // the other side already gave this edge alone: a late partner,
+            // not a new edge, but it shows where the skew has gone
+            if (this->lastSingleLeft != leftFirst) {
+                this->skew = static_cast<Offset>(leftFirst ? edge.at - this->lastSingle : this->lastSingle - edge.at);
+            }
+            continue;
+        }
+        side.singles++;
+        this->lastSingle = edge.at;
+        this->lastSingleLeft = leftFirst;
+        return emit(at, edge.black);
+    }
+}
+
+template<typename Source>
+typename FusedScanner<Source>::Offset FusedScanner<Source>::getSkew() const {
+    return this->skew;
+}
+
+template<typename Source>
+uint16_t FusedScanner<Source>::getMatched() const {
+    return this->matched;
+}
+
+template<typename Source>
+uint16_t FusedScanner<Source>::getSingles(const ScanChannel side) const {
+    return this->sides[side == RightSide].singles;
+}
+
+/*
+ * Reads one side, keeping its new edge, if any. An edge that
+ * comes within a quarter of a narrow element of the one before
+ * cancels it out, as neither was a real edge.
+ */
+template<typename Source>
+void FusedScanner<Source>::read(Side &side, const Lab4::SensorFrame &frame) {
+    if (side.scanner.scan(frame).checkState() != Lab4::Some) {
+        return;
+    }
+    const Edge edge = {side.scanner.lastEdge(), side.scanner.isBlack()};
+    const Offset glitch = this->window() / 2;
+    if (side.count > 0 && static_cast<Offset>(edge.at - side.edges[side.count - 1].at) < glitch) {
+        side.count--;
+        return;
+    }
+    if (side.count == sizeof(side.edges) / sizeof(side.edges[0])) {
+        // the other side has been silent for long, forget the oldest
+        pop(side);
+    }
+    side.edges[side.count++] = edge;
+}
+
+/*
+ * Half a narrow element, 0 if not known yet.
+ */
+template<typename Source>
+typename FusedScanner<Source>::Offset FusedScanner<Source>::window() const {
+    if (this->widthCount < WIDTH_CHARACTER_SIZE) {
+        return 0;
+    }
+    uint32_t total = 0;
+    for (const Stamp width: this->widths) {
+        total += width;
+    }
+    // 9 elements are about 13.5 narrow ones
+    return static_cast<Offset>(total / 27);
+}
+
+template<typename Source>
+typename FusedScanner<Source>::Edge FusedScanner<Source>::pop(Side &side) {
+    const Edge edge = side.edges[0];
+    for (uint8_t i = 1; i < side.count; i++) {
+        side.edges[i - 1] = side.edges[i];
+    }
+    side.count--;
+    return edge;
+}
+
+/*
+ * Records a merged edge and returns the width of the element
+ * it ends. The first width, from the start, is not used for
+ * the narrow width.
+ */
+template<typename Source>
+Lab4::Option<Lab4::Bar> FusedScanner<Source>::emit(const Stamp at, const bool black) {
+    const Stamp width = at - this->merged;
+    this->merged = at;
+    this->black = black;
+    if (this->started) {
+        this->widths[this->widthNext] = width;
+        this->widthNext = (this->widthNext + 1) % WIDTH_CHARACTER_SIZE;
+        if (this->widthCount < WIDTH_CHARACTER_SIZE) {
+            this->widthCount++;
+        }
+    }
+    this->started = true;
+    return Lab4::Option<Lab4::Bar>({widthOf<Source>(width), Lab4::BarType::Null});
+}
+
+template class BasicScanner<TimeSource>;
+template class BasicScanner<EncoderSource>;
+template class FusedScanner<TimeSource>;
+template class FusedScanner<EncoderSource>;
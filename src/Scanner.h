@@ -7,19 +7,90 @@
  * Responsible for bar code widths as scanned from
  * the IR sensors
  *
+ * The width of a bar is the difference between the
+ * positions of its two edges. Where those positions
+ * come from is decided by the Source policy:
+ *
+ * - TimeSource: time, so widths change with speed.
+ * - EncoderSource: distance travelled, so widths
+ *   stay the same whatever the speed.
+ *
+ * An edge is not placed at the frame that first sees
+ * the new colour, but where the reflectance crossed
+ * LINE_THRESHOLD between that frame and the one before,
+ * assuming it changed linearly in between. This keeps
+ * the error of a width well below one frame.
+ *
+ * A BasicScanner reads one side of the barcode, or both
+ * together (black only where both are). FusedScanner
+ * reads both sides independently and merges them.
+ *
  * Date: 2024-11-11
  *
  */
 
-class Scanner {
+/*
+ * Positions in microseconds since the board started.
+ * Wraps around after about 71 minutes; widths are taken
+ * modulo 2^32, so a bar that spans the wrap is still right.
+ * Bars are reported in units of 16 us, which fits up to
+ * about one second into a Lab4::Width.
+ */
+struct TimeSource {
+    typedef uint32_t Stamp;
+    // Signed difference of two stamps
+    typedef int32_t Offset;
+    // Bar widths are stamp differences shifted right by this
+    static const uint8_t WIDTH_SHIFT = 4;
+
+    static Stamp now();
+
+    static Stamp at(const Lab4::SensorFrame &frame) {
+        return frame.timestamp;
+    }
+};
+
+/*
+ * Positions in encoder counts summed over both wheels,
+ * i.e. twice the mean distance. Wraps around; widths are
+ * taken modulo 2^16, which is far longer than any bar.
+ */
+struct EncoderSource {
+    typedef uint16_t Stamp;
+    // Signed difference of two stamps
+    typedef int16_t Offset;
+    // Bar widths are stamp differences shifted right by this
+    static const uint8_t WIDTH_SHIFT = 0;
+
+    static Stamp now();
+
+    static Stamp at(const Lab4::SensorFrame &frame) {
+        return frame.distance;
+    }
+};
+
+// Which IR sensors a scanner reads the barcode with
+typedef enum {
+    // both outer sensors, black only where both see black
+    BothSides,
+    // BARCODE_SENSOR_LEFT alone
+    LeftSide,
+    // BARCODE_SENSOR_RIGHT alone
+    RightSide,
+} ScanChannel;
+
+template<typename Source>
+class BasicScanner {
 public:
+    typedef typename Source::Stamp Stamp;
+
     /**
      *
      * Scans the barcode width from the time of
      * initialization of this object
      *
      */
-    Scanner();
+    explicit BasicScanner(ScanChannel channel = BothSides);
 
     /**
      *
@@ -27,20 +98,36 @@ public:
      * startTime of initialization of this object
      *
      */
-    explicit Scanner(uint64_t startTime);
+    explicit BasicScanner(Stamp startTime, ScanChannel channel = BothSides);
 
     /**
      *
-     * Scans and returns everytime a new value is detected.
+     * Scans the frame and returns everytime a new value is detected.
+     * The edge is interpolated between this frame and the previous one.
      * returns Bar {
-     *  time = how long is the width of that bar
+     *  time = how long is the width of that bar (see Source::WIDTH_SHIFT)
      *  type = NULL
      *}
      * Option<Bar> will be empty if a new value is not detected.
      * It will contain a value if a new value is detected.
      *
      */
-    Lab4::Option<Lab4::Bar> scan();
+    Lab4::Option<Lab4::Bar> scan(const Lab4::SensorFrame &frame);
+
+    /**
+     *
+     * Position of the last edge, where the current
+     * colour started
+     *
+     */
+    Stamp lastEdge() const;
+
+    /**
+     *
+     * Is the colour since the last edge black?
+     *
+     */
+    bool isBlack() const;
 
 private:
     typedef enum {
@@ -50,8 +137,141 @@ private:
         BLACK
     } ReadingState;
 
+    // which sensors we read
+    ScanChannel channel;
     // what are we currently seeing?
     ReadingState state;
     // since when did we start seeing our ReadingState
-    uint64_t t0;
+    Stamp t0;
+
+    // previous frame's barcode level and position, for interpolation
+    uint16_t lastLevel = 0;
+    Stamp lastStamp = 0;
+    bool primed = false;
+
+    // Position where the level crossed LINE_THRESHOLD on the way to this frame
+    Stamp edgeAt(Stamp stamp, uint16_t level) const;
+};
+
+// Bar widths as durations
+typedef BasicScanner<TimeSource> TimeScanner;
+
+// Bar widths as distances
+typedef BasicScanner<EncoderSource> EncoderScanner;
+
+/*
+ * Reads each side of the barcode with its own BasicScanner and
+ * merges the two streams of edges into one.
+ *
+ * The same edge reaches both sides at slightly different
+ * positions when the robot is at an angle to the stripes; that
+ * offset (the skew) is tracked, and an edge seen by both sides
+ * within half a narrow element of the expected skew is placed
+ * halfway between the two. Bars are then as wide as the mean
+ * of both sides, where the AND of both sides would have
+ * shortened every bar by the skew.
+ *
+ * An edge seen by only one side (a stripe missing or smudged
+ * on the other) is used on its own, shifted by half the skew,
+ * as soon as the other side is overdue. Blips shorter than a
+ * quarter of a narrow element on one side are dropped before
+ * they are matched.
+ *
+ * The narrow width is taken from the last 9 merged widths (one
+ * character spans about 13.5 narrow widths); until there are 9,
+ * the sides only need to agree to within half of the element
+ * being ended.
+ */
+template<typename Source>
+class FusedScanner {
+public:
+    typedef typename Source::Stamp Stamp;
+    typedef typename Source::Offset Offset;
+
+    /**
+     *
+     * Scans the barcode width from the time of
+     * initialization of this object
+     *
+     */
+    FusedScanner();
+
+    /**
+     *
+     * Scans the frame with both sides and returns the
+     * next merged width once it is known.
+     * Option<Bar> will be empty if there is none yet.
+     *
+     */
+    Lab4::Option<Lab4::Bar> scan(const Lab4::SensorFrame &frame);
+
+    /**
+     *
+     * Current estimate of how far the left side's edges
+     * come after the right side's
+     *
+     */
+    Offset getSkew() const;
+
+    /**
+     *
+     * Edges seen by both sides, and by one side alone
+     *
+     */
+    uint16_t getMatched() const;
+
+    uint16_t getSingles(ScanChannel side) const;
+
+private:
+    typedef struct {
+        Stamp at;
+        bool black; // colour after the edge
+    } Edge;
+
+    // Edges of one side not merged yet
+    typedef struct {
+        BasicScanner<Source> scanner;
+        Edge edges[4];
+        uint8_t count;
+        uint16_t singles;
+    } Side;
+
+    Side sides[2];
+
+    // Last merged edge, its colour after it and the skew (left - right)
+    Stamp merged;
+    bool black;
+    Offset skew;
+    bool skewKnown;
+
+    // Last 9 merged widths, for the narrow width
+    Stamp widths[WIDTH_CHARACTER_SIZE];
+    uint8_t widthCount;
+    uint8_t widthNext;
+    bool started;
+    uint16_t matched;
+
+    // Where the last edge seen by one side alone was, and which side
+    Stamp lastSingle;
+    bool lastSingleLeft;
+
+    // Reads one side, keeping its new edge, if any
+    void read(Side &side, const Lab4::SensorFrame &frame);
+
+    // Half a narrow element, 0 if not known yet
+    Offset window() const;
+
+    // Takes the head edge of a side
+    Edge pop(Side &side);
+
+    // Records a merged edge and returns the width of the element it
+    // ends; callers only pass edges that change the colour
+    Lab4::Option<Lab4::Bar> emit(Stamp at, bool black);
 };
+
+// Scanner used by the robot (see SCAN_SOURCE and SCAN_FUSION in Lab4.h)
+#if SCAN_FUSION
+typedef FusedScanner<SCAN_SOURCE> Scanner;
+#else
+typedef BasicScanner<SCAN_SOURCE> Scanner;
+#endif
@@ -0,0 +1,95 @@
+#include "Scheduler.h"
+
+/**
+ * Scheduler
+ *
+ * Fixed-rate control tick with execution time statistics.
+ *
+ * Date: 2024-11-21
+ *
+ */
+
+/*
+ * Average execution time in Hal::Clock ticks, 0 if never run.
+ */
+uint16_t Scheduler::TaskStats::mean() const {
+    if (runs == 0) {
+        return 0;
+    }
+    return total / runs;
+}
+
+Scheduler::Scheduler(const uint16_t periodUs) : period(periodUs) {
+    for (auto &task: stats) {
+        task = {UINT16_MAX, 0, 0, 0, 0};
+    }
+}
+
+/*
+ * Starts the ticks and clears the statistics.
+ */
+void Scheduler::begin() {
+    for (auto &task: stats) {
+        task = {UINT16_MAX, 0, 0, 0, 0};
+    }
+    missed = 0;
+    Hal::Ticker::begin(period);
+    tickStart = Hal::Clock::ticks();
+}
+
+/*
+ * Waits for the next tick. Ticks that went by while the
+ * previous one was still running are counted as missed.
+ */
+void Scheduler::waitForTick() {
+    const uint8_t ticks = Hal::Ticker::wait();
+    tickStart = Hal::Clock::ticks();
+    if (ticks > 1 && missed < UINT16_MAX - ticks) {
+        missed += ticks - 1;
+    }
+}
+
+/*
+ * Times `task` from start to now. A task that ends more than
+ * a period after its tick started has overrun.
+ */
+void Scheduler::record(const uint8_t task, const uint16_t start) {
+    const uint16_t end = Hal::Clock::ticks();
+    const uint16_t elapsed = end - start;
+    TaskStats &entry = stats[task];
+
+    if (elapsed < entry.min) {
+        entry.min = elapsed;
+    }
+    if (elapsed > entry.max) {
+        entry.max = elapsed;
+    }
+    if (entry.runs == UINT16_MAX) {
+        // keep the mean meaningful once the counters are full
+        entry.total -= entry.total / entry.runs;
+        entry.runs--;
+    }
+    entry.total += elapsed;
+    entry.runs++;
+
+    const uint16_t sinceTick = end - tickStart;
+    if (sinceTick > static_cast<uint32_t>(period) * Hal::Clock::TICKS_PER_US &&
+        entry.overruns != UINT16_MAX) {
+        entry.overruns++;
+    }
+}
+
+const Scheduler::TaskStats &Scheduler::getStats(const uint8_t task) const {
+    return stats[task];
+}
+
+uint16_t Scheduler::getMissedTicks() const {
+    return missed;
+}
+
+/*
+ * Converts Hal::Clock ticks to microseconds.
+ */
+uint16_t Scheduler::toMicros(const uint16_t ticks) {
+    return ticks / Hal::Clock::TICKS_PER_US;
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include "Lab4.h"
+#include "Hal.h"
+
+/**
+ * Scheduler
+ *
+ * Fixed-rate control tick with execution time statistics.
+ *
+ * The ticks come from the board's Ticker (Timer 3 compare B on
+ * the robot), so the period does not depend on how long the
+ * buzzer, the OLED or the sensors took. Every tick the caller
+ * waits for it, then runs its tasks in order through run(),
+ * which times each one. A tick that started late because the
+ * previous one ran too long counts as missed, and a task that
+ * was still running when the next tick was due counts as an
+ * overrun of that task.
+ *
+ * Date: 2024-11-21
+ *
+ */
+
+class Scheduler {
+public:
+    static const uint8_t MAX_TASKS = 4;
+
+    struct TaskStats {
+        // Execution times, in Hal::Clock ticks
+        uint16_t min;
+        uint16_t max;
+        uint32_t total;
+        // Times run, and how many of those ended after the next tick was due
+        uint16_t runs;
+        uint16_t overruns;
+
+        // Average execution time in Hal::Clock ticks, 0 if never run
+        uint16_t mean() const;
+    };
+
+private:
+    const uint16_t period;
+    uint16_t tickStart = 0;
+    uint16_t missed = 0;
+    TaskStats stats[MAX_TASKS];
+
+    // Times `task` from start to now
+    void record(uint8_t task, uint16_t start);
+
+    // Records the task it was made for when it goes out of scope
+    class Probe {
+        Scheduler &scheduler;
+        const uint8_t task;
+        const uint16_t start;
+
+    public:
+        Probe(Scheduler &scheduler, const uint8_t task)
+            : scheduler(scheduler), task(task), start(Hal::Clock::ticks()) {
+        }
+
+        ~Probe() {
+            scheduler.record(task, start);
+        }
+    };
+
+public:
+    /**
+     * Ticks every periodUs microseconds once started.
+     */
+    explicit Scheduler(uint16_t periodUs = CONTROL_PERIOD);
+
+    /**
+     * Starts the ticks and clears the statistics.
+     */
+    void begin();
+
+    /**
+     * Waits for the next tick. Ticks that went by while the
+     * previous one was still running are counted as missed.
+     */
+    void waitForTick();
+
+    /**
+     * Runs fn as task number `task` (0 - MAX_TASKS-1) of the
+     * current tick and returns whatever fn returned.
+     */
+    template<typename Fn>
+    auto run(const uint8_t task, Fn fn) -> decltype(fn()) {
+        const Probe probe(*this, task);
+        return fn();
+    }
+
+    const TaskStats &getStats(uint8_t task) const;
+
+    uint16_t getMissedTicks() const;
+
+    // Converts Hal::Clock ticks to microseconds
+    static uint16_t toMicros(uint16_t ticks);
+};
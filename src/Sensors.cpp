@@ -1,5 +1,6 @@
 #include "Sensors.h"
-#include "Pololu3piPlus32U4.h"
+#include "Hal.h"
+#include "Profiler.h"
 
 /**
  * Sensors
@@ -11,10 +12,72 @@
  *
  */
 
-namespace Sensors {
-    Pololu3piPlus32U4::LineSensors lineSensors;
-    // values read from the sensors will be stored here
-    static uint16_t lineSensorValues[NUM_SENSORS];
+namespace {
+    // One bit per sensor
+    const uint8_t CENTRAL_SENSORS = (1 << (NUM_SENSORS_END + 1)) - (1 << NUM_SENSORS_START);
+
+    // Where the line was last seen, 0 - 4000, and whether it has been
+    // seen at all since power up
+    uint16_t lastPosition = 0;
+    bool lineSeen = false;
+
+    bool isDark(const Lab4::SensorFrame &frame, const uint8_t sensor) {
+        return frame.values[sensor] > LINE_THRESHOLD;
+    }
+
+#if LINE_POSITION_WIDE
+    /*
+     * Was the line last seen out past the central sensor at the
+     * given position, on the side away from the centre? Before it
+     * has been seen at all, it could be on either side.
+     */
+    bool lastSeenBeyond(const uint16_t position) {
+        if (!lineSeen) {
+            return true;
+        }
+        return position < (NUM_SENSORS - 1) * 1000 / 2 ? lastPosition <= position : lastPosition >= position;
+    }
+#endif
+
+    /*
+     * Sensors whose values are taken as the line, one bit each.
+     *
+     * The outer sensors are left out where what they see is
+     * more likely a barcode stripe:
+     * - both dark at once: the line is narrower than the 64 mm
+     *   between them, a stripe on each side is not;
+     * - dark, or partly so, while the sensor next to it is white,
+     *   unless the line went out that way: the line is a single
+     *   band, so with a central sensor on it that is a stripe on
+     *   one side only, e.g. where the other side's bar is missing
+     *   or printed askew. With none on it, it is the line if that
+     *   is where the line was last seen, as on a sharp curve, and
+     *   a stripe otherwise, as over a gap in the line, where it
+     *   would pull the robot off and keep the end of the line from
+     *   being noticed.
+     */
+    uint8_t lineSensors(const Lab4::SensorFrame &frame) {
+#if LINE_POSITION_WIDE
+        if (isDark(frame, BARCODE_SENSOR_LEFT) && isDark(frame, BARCODE_SENSOR_RIGHT)) {
+            return CENTRAL_SENSORS;
+        }
+        bool central = false;
+        for (uint8_t i = NUM_SENSORS_START; i <= NUM_SENSORS_END; i++) {
+            central = central || isDark(frame, i);
+        }
+        uint8_t used = CENTRAL_SENSORS;
+        if (isDark(frame, NUM_SENSORS_START) || (!central && lastSeenBeyond(NUM_SENSORS_START * 1000))) {
+            used |= 1 << BARCODE_SENSOR_LEFT;
+        }
+        if (isDark(frame, NUM_SENSORS_END) || (!central && lastSeenBeyond(NUM_SENSORS_END * 1000))) {
+            used |= 1 << BARCODE_SENSOR_RIGHT;
+        }
+        return used;
+#else
+        (void) frame;
+        return CENTRAL_SENSORS;
+#endif
+    }
 }
 
 /*
@@ -25,77 +88,135 @@ namespace Sensors {
  * Takes no parameters and returns no values.
  */
 void Sensors::calibrateSensors() {
-    using namespace Pololu3piPlus32U4;
+    using namespace Hal;
 
-    ledRed(true);
-    ledYellow(true);
+    Leds::red(true);
+    Leds::yellow(true);
 
     // Wait 1 second and then begin automatic sensor calibration
     // by rotating in place to sweep the sensors over the line
-    delay(1000);
+    Clock::delay(1000);
 
     // turn left
     Motors::setSpeeds(CALIBRATION_SPEED, -CALIBRATION_SPEED);
     for (int i = 0; i <= 20; i++) {
-        lineSensors.calibrate();
+        LineSensors::calibrate();
     }
 
     // turn all the way to the right
     Motors::setSpeeds(-CALIBRATION_SPEED, CALIBRATION_SPEED);
     for (int i = 0; i <= 40; i++) {
-        lineSensors.calibrate();
+        LineSensors::calibrate();
     }
 
     // turn back to center
     Motors::setSpeeds(CALIBRATION_SPEED, -CALIBRATION_SPEED);
     for (int i = 0; i <= 20; i++) {
-        lineSensors.calibrate();
+        LineSensors::calibrate();
     }
 
     // stop
     Motors::setSpeeds(0, 0);
-    ledRed(false);
-    ledYellow(false);
+    Leds::red(false);
+    Leds::yellow(false);
+}
+
+/*
+ * Takes a new frame from the IR sensors, if one is ready, stamped
+ * with the time it was sampled at and the encoder counts.
+ * This should be called once per tick, and the frame passed to
+ * everything that works on sensor data during that tick.
+ *
+ * Returns bool
+ *
+ * bool == true if a new frame was written to frame
+ * bool == false if the sensors have nothing new yet
+ */
+bool Sensors::acquire(Lab4::SensorFrame *frame) {
+    PROFILE(Acquire);
+    static uint16_t sequence = 0;
+
+    if (!Hal::LineSensors::readCalibrated(frame->values, &frame->timestamp)) {
+        return false;
+    }
+    frame->countsLeft = Hal::Encoders::getCountsLeft();
+    frame->countsRight = Hal::Encoders::getCountsRight();
+    frame->distance = static_cast<uint16_t>(frame->countsLeft + frame->countsRight);
+    frame->sequence = sequence++;
+    return true;
+}
+
+/*
+ * Determines if any of the IR Sensors the position is taken from
+ * sees the line in the given frame
+ *
+ * Returns bool
+ */
+bool Sensors::isLineDetected(const Lab4::SensorFrame &frame) {
+    const uint8_t used = lineSensors(frame);
+    for (uint8_t i = 0; i < NUM_SENSORS; i++) {
+        if (used & 1 << i && isDark(frame, i)) {
+            return true;
+        }
+    }
+    return false;
 }
 
 /*
  * Determines if both Left and Right IR Sensors have detected
- * Barcode
+ * Barcode in the given frame
  *
  * Returns bool
  *
  * bool == true if black color is detected
  * bool == false if white color detected
  */
-bool Sensors::isBarcodeDetected() {
-    return (lineSensorValues[BARCODE_SENSOR_LEFT] > LINE_THRESHOLD) && (
-               lineSensorValues[BARCODE_SENSOR_RIGHT] > LINE_THRESHOLD);
+bool Sensors::isBarcodeDetected(const Lab4::SensorFrame &frame) {
+    return barcodeLevel(frame) > LINE_THRESHOLD;
+}
+
+/*
+ * How black the barcode looks to the Left and Right IR Sensors
+ * together in the given frame: the lower of the two calibrated
+ * values, so it is above LINE_THRESHOLD only when both are.
+ *
+ * Returns uint16_t
+ */
+uint16_t Sensors::barcodeLevel(const Lab4::SensorFrame &frame) {
+    const uint16_t left = frame.values[BARCODE_SENSOR_LEFT];
+    const uint16_t right = frame.values[BARCODE_SENSOR_RIGHT];
+    return left < right ? left : right;
 }
 
 /*
- * Assesses whether the robot's sensors detect the line
- * and calculates the weighted average of the values obtained
+ * Assesses whether the robot's sensors detect the line in the
+ * given frame and calculates the weighted average of the values obtained
  * from the line sensors.
  *
  * Returns Option<int16_t>.
  *
  * If robot's sensors detect the line:
- *   Option<int16_t> will have a value (weighted avg of 3 central IR sensors).
+ *   Option<int16_t> will have a value (weighted avg of the IR sensors,
+ *   0 - 4000, 2000 centred). With LINE_POSITION_WIDE these are all 5,
+ *   but for an outer one that sees a barcode stripe; else the 3
+ *   central ones, 1000 - 3000.
  *
  * If robot's sensors do not detect the line:
  *   Option<int16_t> will be empty.
  */
 
-Lab4::Option<int> Sensors::detectLines() {
+Lab4::Option<int> Sensors::detectLines(const Lab4::SensorFrame &frame) {
+    PROFILE(DetectLines);
     bool onLine = false;
     uint32_t avg = 0; // this is for the weighted total
     uint16_t sum = 0; // this is for the denominator, which is <= 64000
-    static uint16_t lastPosition = 0;
+    const uint8_t used = lineSensors(frame);
 
-    lineSensors.readCalibrated(lineSensorValues);
-
-    for (uint8_t i = NUM_SENSORS_START; i <= NUM_SENSORS_END; i++) {
-        const uint16_t value = lineSensorValues[i];
+    for (uint8_t i = 0; i < NUM_SENSORS; i++) {
+        if (!(used & 1 << i)) {
+            continue;
+        }
+        const uint16_t value = frame.values[i];
 
         // keep track of whether we see the line at all
         if (value > LINE_THRESHOLD) {
@@ -116,7 +237,7 @@ Lab4::Option<int> Sensors::detectLines() {
         }
 
         // If it last read to the left of center, return 0.
-        if (lastPosition < (NUM_SENSORS - 3) * 1000 / 2) {
+        if (lastPosition < (NUM_SENSORS - 1) * 1000 / 2) {
             return Lab4::Option<int>{0};
         }
         // If it last read to the right of center, return the max.
@@ -124,5 +245,6 @@ Lab4::Option<int> Sensors::detectLines() {
     }
 
     lastPosition = avg / sum;
+    lineSeen = true;
     return Lab4::Option<int>{static_cast<int>(lastPosition)};
 }
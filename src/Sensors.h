@@ -22,28 +22,62 @@ namespace Sensors {
     void calibrateSensors();
 
     /*
-     * Assesses whether the robot's sensors detect the line
-     * and calculates the weighted average of the values obtained
+     * Takes a new frame from the IR sensors, if one is ready, stamped
+     * with the time it was sampled at and the encoder counts.
+     * This should be called once per tick, and the frame passed to
+     * everything that works on sensor data during that tick.
+     *
+     * Returns bool
+     *
+     * bool == true if a new frame was written to frame
+     * bool == false if the sensors have nothing new yet
+     */
+    bool acquire(Lab4::SensorFrame *frame);
+
+    /*
+     * Assesses whether the robot's sensors detect the line in the
+     * given frame and calculates the weighted average of the values obtained
      * from the line sensors.
      *
      * Returns Option<int16_t>.
      *
      * If robot's sensors detect the line:
-     *   Option<int16_t> will have a value (weighted avg of 3 central IR sensors).
+     *   Option<int16_t> will have a value (weighted avg of the IR sensors,
+     *   0 - 4000, 2000 centred). With LINE_POSITION_WIDE these are all 5,
+     *   but for an outer one that sees a barcode stripe; else the 3
+     *   central ones, 1000 - 3000.
      *
      * If robot's sensors do not detect the line:
      *   Option<int16_t> will be empty.
      */
-    Lab4::Option<int> detectLines();
+    Lab4::Option<int> detectLines(const Lab4::SensorFrame &frame);
+
+    /*
+     * Determines if any of the IR Sensors detectLines takes the line
+     * from sees it in the given frame, i.e. reads above LINE_THRESHOLD
+     *
+     * Returns bool
+     */
+    bool isLineDetected(const Lab4::SensorFrame &frame);
 
     /*
      * Determines if both Left and Right IR Sensors have detected
-     * Barcode
+     * Barcode in the given frame
      *
      * Returns bool
      *
      * bool == true if black color is detected
      * bool == false if white color detected
      */
-    bool isBarcodeDetected();
+    bool isBarcodeDetected(const Lab4::SensorFrame &frame);
+
+    /*
+     * How black the barcode looks to the Left and Right IR Sensors
+     * together in the given frame: the lower of the two calibrated
+     * values (0 - 1000). The barcode is detected while this is
+     * above LINE_THRESHOLD.
+     *
+     * Returns uint16_t
+     */
+    uint16_t barcodeLevel(const Lab4::SensorFrame &frame);
 }
@@ -0,0 +1,72 @@
+#include <stddef.h>
+
+#include "Settings.h"
+#include "Hal.h"
+
+/**
+ * Settings
+ *
+ * Keeps the line following tuning in EEPROM.
+ *
+ * Date: 2024-11-26
+ *
+ */
+
+namespace Settings {
+    // First bytes of a saved tuning, and the layout version
+    static const uint8_t MAGIC[] = {'L', '4'};
+    static const uint8_t VERSION = 1;
+
+    typedef struct {
+        uint8_t magic[sizeof(MAGIC)];
+        uint8_t version;
+        uint8_t size; // sizeof(Tuning) when saved
+        LineFollowing::Tuning tuning;
+        uint8_t checksum; // of every byte before it, see checksumOf
+    } Record;
+
+    // Where the record is kept
+    static const uint16_t ADDRESS = 0;
+
+    static_assert(ADDRESS + sizeof(Record) <= Hal::Storage::SIZE, "Settings do not fit the EEPROM");
+
+    // Sum of the bytes before the checksum, plus one so an
+    // erased (all 0xFF) or zeroed record never matches
+    static uint8_t checksumOf(const Record &record) {
+        const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&record);
+        uint8_t sum = 1;
+        for (uint8_t i = 0; i < offsetof(Record, checksum); i++) {
+            sum += bytes[i];
+        }
+        return sum;
+    }
+}
+
+/*
+ * Reads the saved tuning into tuning. Returns false, leaving it
+ * as it was, if no valid tuning was saved.
+ */
+bool Settings::load(LineFollowing::Tuning *tuning) {
+    Record record;
+    Hal::Storage::read(ADDRESS, &record, sizeof(record));
+
+    if (memcmp(record.magic, MAGIC, sizeof(MAGIC)) != 0 || record.version != VERSION ||
+        record.size != sizeof(LineFollowing::Tuning) || record.checksum != checksumOf(record)) {
+        return false;
+    }
+    *tuning = record.tuning;
+    return true;
+}
+
+/*
+ * Saves the tuning. Only the bytes that changed are written.
+ */
+void Settings::save(const LineFollowing::Tuning &tuning) {
+    Record record = {};
+    memcpy(record.magic, MAGIC, sizeof(MAGIC));
+    record.version = VERSION;
+    record.size = sizeof(LineFollowing::Tuning);
+    record.tuning = tuning;
+    record.checksum = checksumOf(record);
+    Hal::Storage::write(ADDRESS, &record, sizeof(record));
+}
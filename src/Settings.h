@@ -0,0 +1,32 @@
+#pragma once
+#include "Lab4.h"
+#include "LineFollowing.h"
+
+/**
+ * Settings
+ *
+ * Keeps the line following tuning in EEPROM, so gains changed
+ * from the menu survive a power cycle.
+ *
+ * The tuning is stored at the start of the EEPROM behind a small
+ * header (a magic number, a version and the size of the tuning)
+ * and followed by a checksum, so an empty EEPROM, one written by
+ * other firmware or by a version with another Tuning layout is
+ * ignored rather than loaded as garbage.
+ *
+ * Date: 2024-11-26
+ *
+ */
+
+namespace Settings {
+    /*
+     * Reads the saved tuning into tuning. Returns false, leaving it
+     * as it was, if no valid tuning was saved.
+     */
+    bool load(LineFollowing::Tuning *tuning);
+
+    /*
+     * Saves the tuning. Only the bytes that changed are written.
+     */
+    void save(const LineFollowing::Tuning &tuning);
+}
@@ -0,0 +1,94 @@
+#include "SpeedGovernor.h"
+
+/**
+ * SpeedGovernor
+ *
+ * Speed along the line from how well it is followed.
+ *
+ * Date: 2024-11-28
+ *
+ */
+
+SpeedGovernor::SpeedGovernor(const Limits &limits) : limits(limits) {
+    reset();
+}
+
+/*
+ * Replaces the limits, keeping the speed within them.
+ */
+void SpeedGovernor::setLimits(const Limits &limits) {
+    this->limits = limits;
+    const int16_t speed = this->getSpeed();
+    if (speed < limits.base) {
+        this->speed = static_cast<int16_t>(limits.base * 16);
+    } else if (speed > limits.top) {
+        this->speed = static_cast<int16_t>(limits.top * 16);
+    }
+}
+
+/*
+ * Starts again from the base speed.
+ */
+void SpeedGovernor::reset() {
+    this->speed = static_cast<int16_t>(this->limits.base * 16);
+    this->calmFrames = 0;
+    this->held = false;
+}
+
+/*
+ * Holds the speed, capped at the reading speed, or releases it.
+ */
+void SpeedGovernor::hold(const bool held) {
+    if (held && !this->held && this->getSpeed() > this->readingCap()) {
+        this->speed = static_cast<int16_t>(this->readingCap() * 16);
+    }
+    this->held = held;
+}
+
+/*
+ * Takes the error of the next frame and returns the speed.
+ */
+int16_t SpeedGovernor::update(const int16_t error) {
+    const int16_t magnitude = error < 0 ? -error : error;
+    if (magnitude > GOVERNOR_CALM_ERROR) {
+        this->calmFrames = 0;
+    } else if (this->calmFrames < GOVERNOR_CALM_FRAMES) {
+        this->calmFrames++;
+    }
+    if (this->held) {
+        return this->getSpeed();
+    }
+
+    // speed aimed at, * 16
+    int32_t target = this->speed;
+    if (magnitude >= GOVERNOR_SLOW_ERROR) {
+        target = this->limits.base * 16;
+    } else if (magnitude > GOVERNOR_CALM_ERROR) {
+        // from the top speed down to the base speed as the error
+        // grows, but never faster than now: only a calm line does that
+        const int32_t range = (this->limits.top - this->limits.base) * 16;
+        target = this->limits.top * 16 - range * (magnitude - GOVERNOR_CALM_ERROR) /
+                                             (GOVERNOR_SLOW_ERROR - GOVERNOR_CALM_ERROR);
+        if (target > this->speed) {
+            target = this->speed;
+        }
+    } else if (this->calmFrames >= GOVERNOR_CALM_FRAMES) {
+        target = this->limits.top * 16;
+    }
+
+    if (target > this->speed + GOVERNOR_ACCELERATION) {
+        target = this->speed + GOVERNOR_ACCELERATION;
+    } else if (target < this->speed - GOVERNOR_DECELERATION) {
+        target = this->speed - GOVERNOR_DECELERATION;
+    }
+    this->speed = static_cast<int16_t>(target);
+    return this->getSpeed();
+}
+
+int16_t SpeedGovernor::getSpeed() const {
+    return static_cast<int16_t>(this->speed / 16);
+}
+
+int16_t SpeedGovernor::readingCap() const {
+    return this->limits.reading > this->limits.base ? this->limits.reading : this->limits.base;
+}
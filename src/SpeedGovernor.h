@@ -0,0 +1,75 @@
+#pragma once
+#include "Lab4.h"
+
+/**
+ * SpeedGovernor
+ *
+ * Picks the speed the robot drives along the line at, between a
+ * base speed and a top speed, from how well it follows the line.
+ *
+ * - Once the error has stayed within GOVERNOR_CALM_ERROR for
+ *   GOVERNOR_CALM_FRAMES frames, the speed rises towards the top
+ *   speed by GOVERNOR_ACCELERATION every frame.
+ * - When the error grows past GOVERNOR_CALM_ERROR, the speed aims
+ *   lower the larger the error, down to the base speed at
+ *   GOVERNOR_SLOW_ERROR, and falls there by GOVERNOR_DECELERATION
+ *   every frame, so it backs off smoothly rather than braking hard.
+ * - While held (see hold), e.g. while a character is being read,
+ *   the speed stays where it was, capped at the reading speed, so
+ *   all bars of a character are crossed at the same speed.
+ *
+ * Speeds are in motor speed units, kept * 16 so that they can
+ * change by less than one unit a frame.
+ *
+ * Date: 2024-11-28
+ *
+ */
+
+class SpeedGovernor {
+public:
+    struct Limits {
+        int16_t base; // slowest, and where the robot starts from
+        int16_t top; // fastest on a calm line
+        int16_t reading; // fastest while held, unless the base speed is faster
+    };
+
+    explicit SpeedGovernor(const Limits &limits);
+
+    /*
+     * Replaces the limits. The speed is kept, within the new limits.
+     */
+    void setLimits(const Limits &limits);
+
+    /*
+     * Starts again from the base speed, e.g. before a new run.
+     */
+    void reset();
+
+    /*
+     * Holds the speed at what it is, capped at the reading speed,
+     * until released again.
+     */
+    void hold(bool held);
+
+    /*
+     * Takes the error of the next frame (distance of the line from
+     * the centre) and returns the speed to drive at.
+     */
+    int16_t update(int16_t error);
+
+    int16_t getSpeed() const;
+
+private:
+    Limits limits;
+
+    // Current speed * 16
+    int16_t speed = 0;
+
+    // Frames the error has been calm for, up to GOVERNOR_CALM_FRAMES
+    uint8_t calmFrames = 0;
+
+    bool held = false;
+
+    // Fastest while held
+    int16_t readingCap() const;
+};
@@ -0,0 +1,46 @@
+#include "Timer3.h"
+
+/**
+ * Timer3
+ *
+ * Free-running Timer 3 of the ATmega32U4, counting at 2 MHz.
+ *
+ * Date: 2024-11-20
+ *
+ */
+
+#ifdef ARDUINO
+namespace Timer3 {
+    // Shortest distance into the future a compare may be set to
+    static const uint16_t MIN_LEAD = 8 * TICKS_PER_US;
+}
+
+/*
+ * Starts the timer in normal (free-running) mode.
+ * Safe to call more than once; later calls do nothing.
+ */
+void Timer3::begin() {
+    static bool started = false;
+    if (started) {
+        return;
+    }
+    started = true;
+
+    TCCR3A = 0;
+    TCCR3B = _BV(CS31); // clk/8, normal mode
+    TCCR3C = 0;
+    TCNT3 = 0;
+}
+
+/*
+ * Returns the compare value for `at`, moved forward to shortly
+ * after now if `at` has already gone by.
+ */
+uint16_t Timer3::ahead(const uint16_t at) {
+    const uint16_t current = now();
+    if (static_cast<int16_t>(at - current) < static_cast<int16_t>(MIN_LEAD)) {
+        return current + MIN_LEAD;
+    }
+    return at;
+}
+#endif
@@ -0,0 +1,43 @@
+#pragma once
+#include "Lab4.h"
+
+/**
+ * Timer3
+ *
+ * Free-running Timer 3 of the ATmega32U4, counting at 2 MHz.
+ *
+ * The Pololu libraries use Timers 0, 1 and 4, so Timer 3 is the
+ * robot's own timebase. Its two compare channels are used to
+ * schedule work from interrupts without busy waiting; each user
+ * owns one channel and only ever moves its compare register.
+ *
+ * Date: 2024-11-20
+ *
+ */
+
+#ifdef ARDUINO
+namespace Timer3 {
+    // Timer ticks per microsecond (16 MHz with a /8 prescaler)
+    const uint8_t TICKS_PER_US = 2;
+
+    /*
+     * Starts the timer in normal (free-running) mode.
+     * Safe to call more than once; later calls do nothing.
+     */
+    void begin();
+
+    /*
+     * Current count, wraps around every 32.768 ms.
+     */
+    inline uint16_t now() {
+        return TCNT3;
+    }
+
+    /*
+     * Returns the compare value for `at`, moved forward to shortly
+     * after now if `at` has already gone by, so an interrupt that
+     * ran late never waits for a full wraparound.
+     */
+    uint16_t ahead(uint16_t at);
+}
+#endif
@@ -0,0 +1,183 @@
+#include "Trace.h"
+#include "Hal.h"
+
+/**
+ * Trace
+ *
+ * Compact binary trace of a run, streamed over USB serial.
+ *
+ * Date: 2024-11-22
+ *
+ */
+
+namespace Trace {
+    // Longest record: the tag, two full varints (dropped count and
+    // timestamp) and at most 3 bytes for every other field
+    static const uint8_t MAX_RECORD = 1 + 5 + 5 + (NUM_SENSORS + 4) * 3;
+
+    // Staged bytes, sent from `head` on, wrapping around
+    static uint8_t staged[TRACE_BUFFER_SIZE];
+    static uint16_t head = 0;
+    static uint16_t used = 0;
+
+    // Frame the next delta frame is taken from
+    static Sample last = {};
+    static bool keyNeeded = true;
+
+    static uint16_t droppedTotal = 0;
+    static uint16_t droppedSinceKey = 0;
+
+    // Copies the record into the staging buffer if all of it fits
+    static bool stage(const uint8_t *record, const uint16_t size) {
+        if (TRACE_BUFFER_SIZE - used < size) {
+            if (droppedTotal != UINT16_MAX) {
+                droppedTotal++;
+            }
+            if (droppedSinceKey != UINT16_MAX) {
+                droppedSinceKey++;
+            }
+            return false;
+        }
+        uint16_t at = (head + used) % TRACE_BUFFER_SIZE;
+        for (uint16_t i = 0; i < size; i++) {
+            staged[at] = record[i];
+            at = at + 1 == TRACE_BUFFER_SIZE ? 0 : at + 1;
+        }
+        used += size;
+        return true;
+    }
+
+    static uint8_t putSigned(uint8_t *out, const int32_t value) {
+        return putVarint(out, zigzag(value));
+    }
+}
+
+/*
+ * Writes value as a varint to out, which must have room for 5
+ * bytes. Returns the number of bytes written.
+ */
+uint8_t Trace::putVarint(uint8_t *out, uint32_t value) {
+    uint8_t size = 0;
+    while (value >= 0x80) {
+        out[size++] = static_cast<uint8_t>(value) | 0x80;
+        value >>= 7;
+    }
+    out[size++] = static_cast<uint8_t>(value);
+    return size;
+}
+
+/*
+ * Starts a new trace: clears anything still staged, stages the
+ * header and makes the next frame a key frame.
+ */
+void Trace::begin() {
+    head = 0;
+    used = 0;
+    keyNeeded = true;
+    droppedTotal = 0;
+    droppedSinceKey = 0;
+
+    uint8_t header[sizeof(MAGIC) + 1];
+    for (uint8_t i = 0; i < sizeof(MAGIC); i++) {
+        header[i] = MAGIC[i];
+    }
+    header[sizeof(MAGIC)] = VERSION;
+    stage(header, sizeof(header));
+}
+
+/*
+ * Stages the frame and the motor commands given for it, as a key
+ * frame after a drop and as a delta frame otherwise.
+ */
+void Trace::record(const Lab4::SensorFrame &frame, const int16_t motorLeft, const int16_t motorRight) {
+    Sample sample;
+    sample.timestamp = frame.timestamp;
+    for (uint8_t i = 0; i < NUM_SENSORS; i++) {
+        sample.values[i] = frame.values[i];
+    }
+    sample.countsLeft = frame.countsLeft;
+    sample.countsRight = frame.countsRight;
+    sample.motorLeft = motorLeft;
+    sample.motorRight = motorRight;
+
+    uint8_t record[MAX_RECORD];
+    uint8_t size = 0;
+    if (keyNeeded) {
+        record[size++] = KeyFrame;
+        size += putVarint(record + size, droppedSinceKey);
+        size += putVarint(record + size, sample.timestamp);
+        for (uint8_t i = 0; i < NUM_SENSORS; i++) {
+            size += putVarint(record + size, sample.values[i]);
+        }
+        size += putSigned(record + size, sample.countsLeft);
+        size += putSigned(record + size, sample.countsRight);
+        size += putSigned(record + size, sample.motorLeft);
+        size += putSigned(record + size, sample.motorRight);
+    } else {
+        // counts wrap around, so their differences are taken in 16 bits
+        record[size++] = DeltaFrame;
+        size += putVarint(record + size, sample.timestamp - last.timestamp);
+        for (uint8_t i = 0; i < NUM_SENSORS; i++) {
+            size += putSigned(record + size, static_cast<int32_t>(sample.values[i]) - last.values[i]);
+        }
+        size += putSigned(record + size, static_cast<int16_t>(sample.countsLeft - last.countsLeft));
+        size += putSigned(record + size, static_cast<int16_t>(sample.countsRight - last.countsRight));
+        size += putSigned(record + size, static_cast<int16_t>(sample.motorLeft - last.motorLeft));
+        size += putSigned(record + size, static_cast<int16_t>(sample.motorRight - last.motorRight));
+    }
+
+    if (stage(record, size)) {
+        if (keyNeeded) {
+            droppedSinceKey = 0;
+        }
+        keyNeeded = false;
+        last = sample;
+    } else {
+        keyNeeded = true;
+    }
+}
+
+/*
+ * Stages a note, cut to MAX_NOTE characters.
+ */
+void Trace::note(const char *text) {
+    uint8_t record[2 + MAX_NOTE];
+    uint8_t length = 0;
+    while (length < MAX_NOTE && text[length] != '\0') {
+        record[2 + length] = text[length];
+        length++;
+    }
+    record[0] = Note;
+    record[1] = length;
+    stage(record, 2 + length);
+}
+
+/*
+ * Hands as many staged bytes to the port as it takes without
+ * waiting. Call regularly, e.g. once per tick.
+ */
+void Trace::flush() {
+    while (used > 0) {
+        uint16_t size = Hal::SerialPort::availableForWrite();
+        if (size == 0) {
+            return;
+        }
+        // up to the end of the buffer, the rest on the next pass
+        if (size > used) {
+            size = used;
+        }
+        if (size > TRACE_BUFFER_SIZE - head) {
+            size = TRACE_BUFFER_SIZE - head;
+        }
+        Hal::SerialPort::write(staged + head, size);
+        head = (head + size) % TRACE_BUFFER_SIZE;
+        used -= size;
+    }
+}
+
+/*
+ * Records dropped since begin() because the staging buffer was full.
+ */
+uint16_t Trace::dropped() {
+    return droppedTotal;
+}
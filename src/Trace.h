@@ -0,0 +1,104 @@
+#pragma once
+#include "Lab4.h"
+
+/**
+ * Trace
+ *
+ * Compact binary trace of a run, streamed over USB serial.
+ *
+ * A trace starts with the 4 byte magic "L4TR" and a version byte,
+ * followed by records. Every record starts with its tag byte:
+ *
+ * - KeyFrame: records dropped before it, then the timestamp (us),
+ *   the 5 calibrated sensor values, both encoder counts and both
+ *   motor commands, all as absolute values.
+ * - DeltaFrame: the same fields as differences from the previous
+ *   frame, so a frame usually takes 8 - 14 bytes.
+ * - Note: a length and that many characters of text, e.g. the
+ *   error shown on the display.
+ *
+ * Unsigned numbers are LEB128 varints (7 bits per byte, low bits
+ * first, high bit set on all but the last byte); signed numbers
+ * and differences are zigzag encoded first, so small magnitudes
+ * of either sign stay short.
+ *
+ * Records are staged in TRACE_BUFFER_SIZE bytes of RAM and only
+ * handed to the port as fast as it can take them without waiting,
+ * so tracing never blocks the control loop. A record that does
+ * not fit is dropped, and the next frame is written as a key
+ * frame so the reader can carry on.
+ *
+ * The host side reader is in host/TraceReader.h.
+ *
+ * Date: 2024-11-22
+ *
+ */
+
+namespace Trace {
+    const uint8_t MAGIC[4] = {'L', '4', 'T', 'R'};
+    const uint8_t VERSION = 1;
+
+    typedef enum : uint8_t {
+        DeltaFrame = 1,
+        KeyFrame = 2,
+        Note = 3,
+    } Tag;
+
+    // Longest note kept, longer ones are cut
+    const uint8_t MAX_NOTE = 32;
+
+    // Everything recorded about one control tick
+    typedef struct {
+        uint32_t timestamp; // When the sensors were sampled (us)
+        uint16_t values[NUM_SENSORS]; // Calibrated sensor values (0 - 1000)
+        int16_t countsLeft; // Encoder counts of the left wheel
+        int16_t countsRight; // Encoder counts of the right wheel
+        int16_t motorLeft; // Speed commanded to the left motor
+        int16_t motorRight; // Speed commanded to the right motor
+    } Sample;
+
+    /*
+     * Maps signed to unsigned so that small magnitudes stay small:
+     * 0, -1, 1, -2, 2 ... become 0, 1, 2, 3, 4 ...
+     */
+    inline uint32_t zigzag(const int32_t value) {
+        return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+    }
+
+    inline int32_t unzigzag(const uint32_t value) {
+        return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+    }
+
+    /*
+     * Writes value as a varint to out, which must have room for 5
+     * bytes. Returns the number of bytes written.
+     */
+    uint8_t putVarint(uint8_t *out, uint32_t value);
+
+    /*
+     * Starts a new trace: clears anything still staged, stages the
+     * header and makes the next frame a key frame.
+     */
+    void begin();
+
+    /*
+     * Stages the frame and the motor commands given for it.
+     */
+    void record(const Lab4::SensorFrame &frame, int16_t motorLeft, int16_t motorRight);
+
+    /*
+     * Stages a note, cut to MAX_NOTE characters.
+     */
+    void note(const char *text);
+
+    /*
+     * Hands as many staged bytes to the port as it takes without
+     * waiting. Call regularly, e.g. once per tick.
+     */
+    void flush();
+
+    /*
+     * Records dropped since begin() because the staging buffer was full.
+     */
+    uint16_t dropped();
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+/**
+ * Arduino (native)
+ *
+ * The small part of the Arduino core that the shared sources use,
+ * so they compile unchanged for the native environment.
+ * Anything that touches hardware goes through Hal.h instead.
+ *
+ * Date: 2024-11-18
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cstdlib>
+
+using std::abs;
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+// Program memory is ordinary memory on the host
+#define PROGMEM
+#define pgm_read_byte(address) (*reinterpret_cast<const uint8_t *>(address))
@@ -0,0 +1,117 @@
+#include "FrameFile.h"
+
+#include <fstream>
+#include <sstream>
+
+/**
+ * FrameFile
+ *
+ * Plain text file of recorded runs.
+ *
+ * Date: 2024-11-23
+ *
+ */
+
+namespace FrameFile {
+    // Reads the frame fields after "frame"; false if any is missing or extra
+    static bool parseFrame(std::istringstream &fields, Trace::Sample *sample) {
+        uint32_t timestamp;
+        int32_t values[NUM_SENSORS + 2];
+        if (!(fields >> timestamp)) {
+            return false;
+        }
+        for (int32_t &value: values) {
+            if (!(fields >> value)) {
+                return false;
+            }
+        }
+        std::string extra;
+        if (fields >> extra) {
+            return false;
+        }
+        *sample = {};
+        sample->timestamp = timestamp;
+        for (int i = 0; i < NUM_SENSORS; i++) {
+            sample->values[i] = static_cast<uint16_t>(values[i]);
+        }
+        sample->countsLeft = static_cast<int16_t>(values[NUM_SENSORS]);
+        sample->countsRight = static_cast<int16_t>(values[NUM_SENSORS + 1]);
+        return true;
+    }
+}
+
+/*
+ * Reads every run in the file at path. Returns false, with the
+ * reason in error, if it cannot be read or a line is malformed.
+ */
+bool FrameFile::load(const char *path, std::vector<Run> *runs, std::string *error) {
+    std::ifstream file(path);
+    if (!file) {
+        *error = std::string("cannot read ") + path;
+        return false;
+    }
+
+    runs->clear();
+    std::string line;
+    for (int number = 1; std::getline(file, line); number++) {
+        const std::string where = "line " + std::to_string(number) + ": ";
+        std::istringstream fields(line);
+        std::string keyword;
+        if (!(fields >> keyword) || keyword[0] == '#') {
+            continue;
+        }
+
+        if (keyword == "run") {
+            runs->push_back(Run{{}, 0, "", number});
+            continue;
+        }
+        if (runs->empty()) {
+            *error = where + keyword + " before the first run";
+            return false;
+        }
+        Run &run = runs->back();
+        if (keyword == "frame") {
+            Trace::Sample sample;
+            if (!parseFrame(fields, &sample)) {
+                *error = where + "malformed frame";
+                return false;
+            }
+            run.frames.push_back(sample);
+        } else if (keyword == "dropped") {
+            uint32_t dropped;
+            if (!(fields >> dropped)) {
+                *error = where + "malformed dropped";
+                return false;
+            }
+            run.dropped += dropped;
+        } else if (keyword == "result" || keyword == "error") {
+            std::string text;
+            std::getline(fields >> std::ws, text);
+            run.outcome = text.empty() ? keyword : keyword + " " + text;
+        } else {
+            *error = where + "unknown item " + keyword;
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Writes the run, starting with its "run" line.
+ */
+void FrameFile::write(FILE *file, const Run &run) {
+    fprintf(file, "run\n");
+    if (run.dropped != 0) {
+        fprintf(file, "dropped %u\n", run.dropped);
+    }
+    for (const Trace::Sample &sample: run.frames) {
+        fprintf(file, "frame %u", sample.timestamp);
+        for (const uint16_t value: sample.values) {
+            fprintf(file, " %u", value);
+        }
+        fprintf(file, " %d %d\n", sample.countsLeft, sample.countsRight);
+    }
+    if (!run.outcome.empty()) {
+        fprintf(file, "%s\n", run.outcome.c_str());
+    }
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "Trace.h"
+
+/**
+ * FrameFile
+ *
+ * Plain text file of recorded runs, as replayed by host/replay.
+ * One item per line, fields separated by spaces:
+ *
+ *   # any comment
+ *   run
+ *   frame <timestamp us> <s0> <s1> <s2> <s3> <s4> <countsLeft> <countsRight>
+ *   dropped <records>
+ *   result <characters read>
+ *   error <message shown>
+ *
+ * Every "run" starts a new run, made of the frames that follow in
+ * the order they were taken. "result" or "error" is what the robot
+ * showed at the end of the run, and "dropped" says frames are
+ * missing from it. Frame files are written by `tracedump --frames`
+ * from a serial capture, and can be edited by hand.
+ *
+ * Date: 2024-11-23
+ *
+ */
+
+namespace FrameFile {
+    typedef struct {
+        // Frames as taken, motor commands are not kept
+        std::vector<Trace::Sample> frames;
+        // Records missing from the run
+        uint32_t dropped;
+        // "result ..." or "error ...", empty if the run has no end
+        std::string outcome;
+        // Line of the file the run starts on
+        int line;
+    } Run;
+
+    /*
+     * Reads every run in the file at path. Returns false, with the
+     * reason in error, if it cannot be read or a line is malformed.
+     */
+    bool load(const char *path, std::vector<Run> *runs, std::string *error);
+
+    /*
+     * Writes the run, starting with its "run" line.
+     */
+    void write(FILE *file, const Run &run);
+}
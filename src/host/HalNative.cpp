@@ -0,0 +1,43 @@
+#include "HalNative.h"
+
+/**
+ * HalNative
+ *
+ * State of the simulated board.
+ *
+ * Date: 2024-11-18
+ *
+ */
+
+using namespace Hal;
+
+uint32_t Native::Clock::now = 0;
+uint32_t Native::Ticker::next = 0;
+uint32_t Native::Ticker::period = LINE_SENSOR_PERIOD;
+Native::FrameSource Native::LineSensors::source = nullptr;
+int16_t Native::Motors::left = 0;
+int16_t Native::Motors::right = 0;
+int16_t Native::Encoders::left = 0;
+int16_t Native::Encoders::right = 0;
+const char *Native::Buzzer::last = nullptr;
+uint16_t Native::Buzzer::played = 0;
+Native::SerialSink Native::SerialPort::sink = nullptr;
+uint8_t Native::Storage::memory[Native::Storage::SIZE];
+
+/*
+ * Puts the board back into its power-on state.
+ */
+void Native::reset() {
+    Clock::now = 0;
+    Ticker::next = 0;
+    Ticker::period = LINE_SENSOR_PERIOD;
+    LineSensors::source = nullptr;
+    Motors::left = 0;
+    Motors::right = 0;
+    Encoders::left = 0;
+    Encoders::right = 0;
+    Buzzer::last = nullptr;
+    Buzzer::played = 0;
+    SerialPort::sink = nullptr;
+    memset(Storage::memory, 0xFF, sizeof(Storage::memory));
+}
@@ -0,0 +1,178 @@
+#pragma once
+#include "Lab4.h"
+
+/**
+ * HalNative
+ *
+ * Simulated board for the native environment.
+ *
+ * Time only moves when the host program advances it, line sensor
+ * frames come from a host supplied source, the host moves the wheel
+ * encoders, and motor commands are latched so the host can read
+ * them back. This keeps every run deterministic and lets it run
+ * as fast as the host allows.
+ *
+ * Date: 2024-11-18
+ *
+ */
+
+namespace Hal {
+    struct Native {
+        // Produces the next calibrated frame when the sensors are read
+        typedef void (*FrameSource)(uint16_t values[NUM_SENSORS]);
+
+        // Receives the bytes written to the serial port
+        typedef void (*SerialSink)(const uint8_t *data, uint16_t size);
+
+        struct Clock {
+            // Virtual time in microseconds
+            static uint32_t now;
+
+            static uint32_t millis() {
+                return now / 1000;
+            }
+
+            static uint32_t micros() {
+                return now;
+            }
+
+            static void delay(const uint32_t ms) {
+                now += ms * 1000;
+            }
+
+            // Moves virtual time forward.
+            static void advance(const uint32_t us) {
+                now += us;
+            }
+
+            static const uint8_t TICKS_PER_US = 1;
+
+            static uint16_t ticks() {
+                return static_cast<uint16_t>(now);
+            }
+        };
+
+        struct Ticker {
+            // Virtual time of the next tick and the time between two
+            static uint32_t next;
+            static uint32_t period;
+
+            static void begin(const uint16_t periodUs) {
+                period = periodUs;
+                next = Clock::now + period;
+            }
+
+            // Idles (moves virtual time) up to the next tick if it is
+            // still ahead. Returns how many ticks went by.
+            static uint8_t wait() {
+                if (static_cast<int32_t>(next - Clock::now) > 0) {
+                    Clock::now = next;
+                }
+                const uint32_t ticks = (Clock::now - next) / period + 1;
+                next += ticks * period;
+                return ticks > UINT8_MAX ? UINT8_MAX : static_cast<uint8_t>(ticks);
+            }
+        };
+
+        struct LineSensors {
+            // Called for every frame; frames are all white if not set
+            static FrameSource source;
+
+            static void calibrate() {
+            }
+
+            static bool readCalibrated(uint16_t values[NUM_SENSORS], uint32_t *timestamp) {
+                if (source == nullptr) {
+                    memset(values, 0, NUM_SENSORS * sizeof(uint16_t));
+                } else {
+                    source(values);
+                }
+                *timestamp = Clock::now;
+                return true;
+            }
+        };
+
+        struct Motors {
+            // Last commanded speeds
+            static int16_t left;
+            static int16_t right;
+
+            static void setSpeeds(const int16_t leftSpeed, const int16_t rightSpeed) {
+                left = leftSpeed;
+                right = rightSpeed;
+            }
+        };
+
+        struct Encoders {
+            // Wheel counts, moved by the host
+            static int16_t left;
+            static int16_t right;
+
+            static int16_t getCountsLeft() {
+                return left;
+            }
+
+            static int16_t getCountsRight() {
+                return right;
+            }
+        };
+
+        struct Buzzer {
+            // Last sequence played and how many were played
+            static const char *last;
+            static uint16_t played;
+
+            // Sequences end at once, nothing is ever still playing
+            static void play(const char *sequence) {
+                last = sequence;
+                played++;
+            }
+
+            static bool isPlaying() {
+                return false;
+            }
+        };
+
+        struct SerialPort {
+            // Called for every write; nothing is connected if not set
+            static SerialSink sink;
+
+            // Room of one USB packet, none if nothing is connected
+            static uint16_t availableForWrite() {
+                return sink == nullptr ? 0 : 64;
+            }
+
+            static void write(const uint8_t *data, const uint16_t size) {
+                if (sink != nullptr) {
+                    sink(data, size);
+                }
+            }
+        };
+
+        struct Leds {
+            static void red(bool) {
+            }
+
+            static void yellow(bool) {
+            }
+        };
+
+        struct Storage {
+            static const uint16_t SIZE = 1024;
+
+            // Contents, erased (all 0xFF) on reset
+            static uint8_t memory[SIZE];
+
+            static void read(const uint16_t address, void *data, const uint16_t size) {
+                memcpy(data, memory + address, size);
+            }
+
+            static void write(const uint16_t address, const void *data, const uint16_t size) {
+                memcpy(memory + address, data, size);
+            }
+        };
+
+        // Puts the board back into its power-on state.
+        static void reset();
+    };
+}
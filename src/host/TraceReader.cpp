@@ -0,0 +1,196 @@
+#include "TraceReader.h"
+
+#include <stdio.h>
+
+/**
+ * TraceReader
+ *
+ * Reads the traces written by Trace back into samples on the host.
+ *
+ * Date: 2024-11-22
+ *
+ */
+
+TraceReader::TraceReader(std::vector<uint8_t> bytes) : bytes(std::move(bytes)) {
+    // skip whatever the port carried before the first run
+    while (this->position < this->bytes.size() && !atHeader()) {
+        this->position++;
+    }
+}
+
+/*
+ * Reads a whole file into bytes. Returns false if it could not be read.
+ */
+bool TraceReader::load(const char *path, std::vector<uint8_t> *bytes) {
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    bytes->clear();
+    uint8_t chunk[4096];
+    size_t size;
+    while ((size = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        bytes->insert(bytes->end(), chunk, chunk + size);
+    }
+    const bool ok = ferror(file) == 0;
+    fclose(file);
+    return ok;
+}
+
+/*
+ * Reads the next record. Returns false at the end of the
+ * trace, or if it is broken (see failed()).
+ */
+bool TraceReader::next(Record *record) {
+    if (failed() || this->position >= this->bytes.size()) {
+        return false;
+    }
+
+    record->key = false;
+    record->dropped = 0;
+    record->text.clear();
+
+    if (atHeader()) {
+        const uint8_t version = this->bytes[this->position + sizeof(Trace::MAGIC)];
+        if (version != Trace::VERSION) {
+            return fail("unsupported version " + std::to_string(version));
+        }
+        this->position += sizeof(Trace::MAGIC) + 1;
+        this->keyed = false;
+        record->kind = Start;
+        return true;
+    }
+
+    const uint8_t tag = this->bytes[this->position++];
+    switch (tag) {
+        case Trace::KeyFrame: {
+            uint32_t dropped;
+            uint32_t value;
+            int32_t signedValue;
+            Trace::Sample sample;
+            if (!readVarint(&dropped) || !readVarint(&sample.timestamp)) {
+                return false;
+            }
+            for (uint16_t &sensor: sample.values) {
+                if (!readVarint(&value)) {
+                    return false;
+                }
+                sensor = static_cast<uint16_t>(value);
+            }
+            int16_t *fields[] = {&sample.countsLeft, &sample.countsRight, &sample.motorLeft, &sample.motorRight};
+            for (int16_t *field: fields) {
+                if (!readSigned(&signedValue)) {
+                    return false;
+                }
+                *field = static_cast<int16_t>(signedValue);
+            }
+            this->keyed = true;
+            this->last = sample;
+            record->kind = Frame;
+            record->key = true;
+            record->dropped = dropped;
+            record->sample = sample;
+            return true;
+        }
+        case Trace::DeltaFrame: {
+            if (!this->keyed) {
+                return fail("delta frame before any key frame");
+            }
+            uint32_t elapsed;
+            int32_t delta;
+            Trace::Sample sample = this->last;
+            if (!readVarint(&elapsed)) {
+                return false;
+            }
+            sample.timestamp += elapsed;
+            for (uint16_t &sensor: sample.values) {
+                if (!readSigned(&delta)) {
+                    return false;
+                }
+                sensor = static_cast<uint16_t>(sensor + delta);
+            }
+            int16_t *fields[] = {&sample.countsLeft, &sample.countsRight, &sample.motorLeft, &sample.motorRight};
+            for (int16_t *field: fields) {
+                if (!readSigned(&delta)) {
+                    return false;
+                }
+                *field = static_cast<int16_t>(*field + delta);
+            }
+            this->last = sample;
+            record->kind = Frame;
+            record->sample = sample;
+            return true;
+        }
+        case Trace::Note: {
+            if (this->position >= this->bytes.size()) {
+                return fail("note cut off");
+            }
+            const uint8_t length = this->bytes[this->position++];
+            if (this->bytes.size() - this->position < length) {
+                return fail("note cut off");
+            }
+            record->kind = Text;
+            record->text.assign(this->bytes.begin() + this->position,
+                                this->bytes.begin() + this->position + length);
+            this->position += length;
+            return true;
+        }
+        default: {
+            return fail("unknown tag " + std::to_string(tag));
+        }
+    }
+}
+
+bool TraceReader::failed() const {
+    return !this->problem.empty();
+}
+
+const std::string &TraceReader::error() const {
+    return this->problem;
+}
+
+size_t TraceReader::offset() const {
+    return this->position;
+}
+
+// Records what went wrong at the current offset, always returns false
+bool TraceReader::fail(const std::string &message) {
+    this->problem = message + " at offset " + std::to_string(this->position);
+    return false;
+}
+
+bool TraceReader::atHeader() const {
+    if (this->bytes.size() - this->position < sizeof(Trace::MAGIC) + 1) {
+        return false;
+    }
+    for (size_t i = 0; i < sizeof(Trace::MAGIC); i++) {
+        if (this->bytes[this->position + i] != Trace::MAGIC[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool TraceReader::readVarint(uint32_t *value) {
+    *value = 0;
+    for (uint8_t shift = 0; shift < 35; shift += 7) {
+        if (this->position >= this->bytes.size()) {
+            return fail("record cut off");
+        }
+        const uint8_t byte = this->bytes[this->position++];
+        *value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return fail("varint too long");
+}
+
+bool TraceReader::readSigned(int32_t *value) {
+    uint32_t raw;
+    if (!readVarint(&raw)) {
+        return false;
+    }
+    *value = Trace::unzigzag(raw);
+    return true;
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "Trace.h"
+
+/**
+ * TraceReader
+ *
+ * Reads the traces written by Trace (see Trace.h) back into
+ * samples on the host, e.g. from a capture of the robot's USB
+ * serial port.
+ *
+ * A capture may hold several runs, each starting with its own
+ * header; anything before the first header is skipped.
+ *
+ * Date: 2024-11-22
+ *
+ */
+
+class TraceReader {
+public:
+    typedef enum {
+        // a header, every run starts with one
+        Start,
+        // one control tick, in `sample`
+        Frame,
+        // a note, in `text`
+        Text,
+    } Kind;
+
+    typedef struct {
+        Kind kind;
+        Trace::Sample sample;
+        // frame was a key frame, and how many records were dropped before it
+        bool key;
+        uint32_t dropped;
+        std::string text;
+    } Record;
+
+    explicit TraceReader(std::vector<uint8_t> bytes);
+
+    /*
+     * Reads a whole file into bytes. Returns false if it could not be read.
+     */
+    static bool load(const char *path, std::vector<uint8_t> *bytes);
+
+    /*
+     * Reads the next record. Returns false at the end of the
+     * trace, or if it is broken (see failed()).
+     */
+    bool next(Record *record);
+
+    // True if reading stopped on a broken or cut off record
+    bool failed() const;
+
+    // What was wrong, empty if nothing
+    const std::string &error() const;
+
+    // Offset of the next byte to read
+    size_t offset() const;
+
+private:
+    std::vector<uint8_t> bytes;
+    size_t position = 0;
+    std::string problem;
+
+    // a key frame was read since the last header
+    bool keyed = false;
+    Trace::Sample last = {};
+
+    bool fail(const std::string &message);
+    bool atHeader() const;
+    bool readVarint(uint32_t *value);
+    bool readSigned(int32_t *value);
+};
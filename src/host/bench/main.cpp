@@ -0,0 +1,562 @@
+/**
+ * Native benchmarks
+ *
+ * Times the decode hot path on the host and checks the optimised
+ * routines against the reference ones they replaced, and the
+ * building blocks that cannot be checked on the robot.
+ *
+ * Date: 2024-11-19
+ */
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "Hal.h"
+#include "Parser.h"
+#include "Pid.h"
+#include "Scanner.h"
+#include "Sensors.h"
+#include "Settings.h"
+#include "SpeedGovernor.h"
+#include "code39.h"
+
+using namespace Parser;
+using namespace Lab4;
+
+// Number of times every benchmark walks over its inputs
+static const int ROUNDS = 2000;
+
+// Number of inputs every benchmark uses
+static const int INPUT_COUNT = 1024;
+
+// Keeps results alive so the optimiser cannot drop the work
+static volatile int sink = 0;
+
+/*
+ * Returns nanoseconds per call of body(i) for every input index i.
+ */
+template<typename Body>
+static double timePerCall(Body body) {
+    const auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < INPUT_COUNT; i++) {
+            body(i);
+        }
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / (ROUNDS * INPUT_COUNT);
+}
+
+/*
+ * The linear code39 search KNNParser::lex used before the lookup table.
+ */
+static Option<char> lexLinear(const Buffer<BarType, WIDTH_CHARACTER_SIZE> &code) {
+    for (auto i: code39) {
+        if (strncmp(reinterpret_cast<const char *>(code.buffer), i + 1, WIDTH_CHARACTER_SIZE) == 0) {
+            return Option<char>(i[0]);
+        }
+    }
+    return {};
+}
+
+/*
+ * Builds the pattern for a 9 bit key, first bar in the most significant bit.
+ */
+static Buffer<BarType, WIDTH_CHARACTER_SIZE> patternOf(const int key) {
+    Buffer<BarType, WIDTH_CHARACTER_SIZE> code;
+    for (int i = WIDTH_CHARACTER_SIZE - 1; i >= 0; i--) {
+        code.add(key >> i & 1 ? Wide : Narrow);
+    }
+    return code;
+}
+
+/*
+ * Compares lex against the linear search over every possible pattern and
+ * times both on a mix of valid characters.
+ */
+static bool benchmarkLex() {
+    for (int key = 0; key < 1 << WIDTH_CHARACTER_SIZE; key++) {
+        const auto code = patternOf(key);
+        const Option<char> expected = lexLinear(code);
+        const Option<char> actual = KNNParser::lex(code);
+        if (expected.checkState() != actual.checkState() ||
+            (expected.checkState() == Some && expected.getValue() != actual.getValue())) {
+            printf("lex: mismatch for pattern %03x\n", key);
+            return false;
+        }
+    }
+
+    static Buffer<BarType, WIDTH_CHARACTER_SIZE> inputs[INPUT_COUNT];
+    std::mt19937 random(243);
+    for (auto &input: inputs) {
+        const auto &row = code39[random() % 44];
+        for (int i = 1; i <= WIDTH_CHARACTER_SIZE; i++) {
+            input.add(static_cast<BarType>(row[i]));
+        }
+    }
+
+    const double linear = timePerCall([](const int i) { sink += lexLinear(inputs[i]).getValue(); });
+    const double table = timePerCall([](const int i) { sink += KNNParser::lex(inputs[i]).getValue(); });
+    printf("lex: linear search %7.2f ns, lookup table %7.2f ns (%.1fx)\n", linear, table, linear / table);
+    return true;
+}
+
+/*
+ * Bar of the given type whose width is drawn around the nominal
+ * Narrow/Wide width with the given relative jitter.
+ */
+static Bar noisyBar(std::mt19937 &random, const BarType type, const double jitter) {
+    const double nominal = type == Wide ? 50.0 : 20.0;
+    std::normal_distribution<double> noise(1.0, jitter);
+    return Bar{static_cast<Width>(nominal * noise(random) + 0.5), Null};
+}
+
+/*
+ * Trains both classifier strategies on a noisy '*' and compares their
+ * accuracy and cost on noisy bars at several jitter levels.
+ */
+static bool benchmarkClassifiers() {
+    static Bar inputs[INPUT_COUNT];
+    static BarType labels[INPUT_COUNT];
+    const char starPatternLabel[WIDTH_CHARACTER_SIZE] = CODE39_DELIMITER_PATTERN;
+
+    for (const double jitter: {0.05, 0.15, 0.25}) {
+        std::mt19937 random(243);
+        Buffer<Bar, WIDTH_CHARACTER_SIZE> trainingBatch;
+        for (const char label: starPatternLabel) {
+            Bar bar = noisyBar(random, static_cast<BarType>(label), jitter);
+            bar.type = static_cast<BarType>(label);
+            trainingBatch.add(&bar);
+        }
+        for (int i = 0; i < INPUT_COUNT; i++) {
+            labels[i] = random() % 3 == 0 ? Wide : Narrow;
+            inputs[i] = noisyBar(random, labels[i], jitter);
+        }
+
+        static KNNParser parser;
+        parser.train(&trainingBatch);
+        for (const ClassifierStrategy strategy: {KNearestNeighbour, Threshold}) {
+            parser.setStrategy(strategy);
+            int correct = 0;
+            for (int i = 0; i < INPUT_COUNT; i++) {
+                correct += parser.getBarType(&inputs[i]) == labels[i];
+            }
+            const double cost = timePerCall([](const int i) { sink += parser.getBarType(&inputs[i]); });
+            printf("getBarType: jitter %2.0f%% %-9s accuracy %6.2f%% %7.2f ns\n", jitter * 100,
+                   strategy == Threshold ? "threshold" : "knn", 100.0 * correct / INPUT_COUNT, cost);
+        }
+    }
+    return true;
+}
+
+/*
+ * Decodes random characters whose bar widths drift away from the '*' used
+ * for training, as when the robot speeds up along the track, and compares
+ * the character error rate and cost of every strategy, with and without
+ * adapting the model to every decoded character.
+ */
+static bool benchmarkCharacters() {
+    static Buffer<Bar, WIDTH_CHARACTER_SIZE> inputs[INPUT_COUNT];
+    static char expected[INPUT_COUNT];
+    const char starPatternLabel[WIDTH_CHARACTER_SIZE] = CODE39_DELIMITER_PATTERN;
+
+    for (const double drift: {0.0, 0.5, 1.0}) {
+        std::mt19937 random(243);
+        Buffer<Bar, WIDTH_CHARACTER_SIZE> trainingBatch;
+        for (const char label: starPatternLabel) {
+            Bar bar = noisyBar(random, static_cast<BarType>(label), 0.1);
+            bar.type = static_cast<BarType>(label);
+            trainingBatch.add(&bar);
+        }
+        for (int i = 0; i < INPUT_COUNT; i++) {
+            // widths shrink by up to `drift` as the robot speeds up
+            const double scale = 1.0 - drift * i / INPUT_COUNT * 0.6;
+            const auto &row = code39[random() % 44];
+            expected[i] = row[0];
+            inputs[i] = {};
+            for (int j = 1; j <= WIDTH_CHARACTER_SIZE; j++) {
+                Bar bar = noisyBar(random, static_cast<BarType>(row[j]), 0.1);
+                bar.time = static_cast<Width>(bar.time * scale + 0.5);
+                inputs[i].add(&bar);
+            }
+        }
+
+        static KNNParser parser;
+        for (const ClassifierStrategy strategy: {KNearestNeighbour, Threshold, WidestThree, Normalised}) {
+            for (const bool adaptive: {false, true}) {
+                // every pass starts from the '*' alone
+                parser.train(&trainingBatch);
+                parser.setStrategy(strategy);
+                parser.setAdaptive(adaptive);
+                int correct = 0;
+                for (int i = 0; i < INPUT_COUNT; i++) {
+                    const Option<char> parsed = parser.decode(inputs[i]);
+                    correct += parsed.checkState() == Some && parsed.getValue() == expected[i];
+                }
+                const double cost = timePerCall([](const int i) { sink += parser.decode(inputs[i]).checkState(); });
+                const char *const names[] = {"knn", "threshold", "widest3", "normalised"};
+                const char *name = names[strategy];
+                printf("decode: drift %3.0f%% %-10s %-8s accuracy %6.2f%% %7.2f ns\n", drift * 60, name,
+                       adaptive ? "adaptive" : "fixed", 100.0 * correct / INPUT_COUNT, cost);
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ * Fraction (0 - 1000) of a sensor aperture centred on t that lies over
+ * the black elements between edges (black starts at even indices).
+ */
+static uint16_t coverage(const std::vector<double> &edges, const double t, const double aperture) {
+    const double from = t - aperture / 2;
+    const double to = t + aperture / 2;
+    double black = 0;
+    for (size_t i = 0; i + 1 < edges.size(); i += 2) {
+        const double start = std::max(from, edges[i]);
+        const double end = std::min(to, edges[i + 1]);
+        black += std::max(0.0, end - start);
+    }
+    return static_cast<uint16_t>(1000 * black / aperture + 0.5);
+}
+
+/*
+ * Spread of width errors, kept apart for bars and spaces since the
+ * threshold makes one longer and the other shorter by a fixed amount.
+ */
+struct WidthErrors {
+    double sum[2] = {};
+    double squares[2] = {};
+    int count[2] = {};
+
+    void add(const bool black, const double error) {
+        sum[black] += error;
+        squares[black] += error * error;
+        count[black]++;
+    }
+
+    // Standard deviation, averaged over bars and spaces
+    double spread() const {
+        double total = 0;
+        for (int i = 0; i < 2; i++) {
+            const double mean = sum[i] / count[i];
+            total += std::sqrt(squares[i] / count[i] - mean * mean);
+        }
+        return total / 2;
+    }
+};
+
+/*
+ * Scans random bars with a sensor that blurs edges over its aperture,
+ * sampled every CONTROL_PERIOD at a random phase, and compares the
+ * spread of width errors of interpolated edges with that of edges
+ * placed at the frame that first saw the new colour.
+ */
+static bool benchmarkEdges() {
+    std::mt19937 random(243);
+    std::uniform_real_distribution<double> phase(0, CONTROL_PERIOD);
+    const double aperture = 3000;
+
+    for (const double speed: {1.0, 2.0, 3.0}) {
+        WidthErrors interpolated;
+        WidthErrors sampled;
+
+        for (int run = 0; run < 64; run++) {
+            std::vector<double> edges;
+            double t = 100000;
+            for (int i = 0; i < 40; i++) {
+                edges.push_back(t);
+                t += (random() % 3 == 0 ? 50000 : 20000) / speed;
+            }
+
+            const double start = phase(random);
+            TimeScanner scanner(static_cast<uint32_t>(start));
+            SensorFrame frame = {};
+            bool wasBlack = false;
+            double lastEdge = start;
+            size_t seen = 0;
+            for (double now = start; now < t + 100000; now += CONTROL_PERIOD) {
+                frame.values[BARCODE_SENSOR_LEFT] = coverage(edges, now, aperture / speed);
+                frame.values[BARCODE_SENSOR_RIGHT] = frame.values[BARCODE_SENSOR_LEFT];
+                frame.timestamp = static_cast<uint32_t>(now);
+
+                const bool black = frame.values[BARCODE_SENSOR_LEFT] > LINE_THRESHOLD;
+                const Option<Bar> bar = scanner.scan(frame);
+                if (black != wasBlack) {
+                    // the first width starts before the first edge
+                    if (seen > 0 && seen < edges.size()) {
+                        const double truth = edges[seen] - edges[seen - 1];
+                        const double width = bar.getValue().time << TimeSource::WIDTH_SHIFT;
+                        interpolated.add(wasBlack, width - truth);
+                        sampled.add(wasBlack, now - lastEdge - truth);
+                    }
+                    wasBlack = black;
+                    lastEdge = now;
+                    seen++;
+                }
+            }
+        }
+        printf("edges: speed x%.0f width error spread sampled %7.1f us interpolated %7.1f us\n", speed,
+               sampled.spread(), interpolated.spread());
+        if (interpolated.spread() >= sampled.spread()) {
+            printf("edges: interpolation did not help\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Checks Ring on its own: wraparound of the free running indices,
+ * refusing pushes when full and counting them as lost, then 200000
+ * values through a 16 element ring on a fixed schedule of pushes and
+ * pops, which must all arrive, in order, as refused pushes are retried.
+ */
+static bool checkRing() {
+    Ring<uint16_t, 4> small;
+    uint16_t next = 0;
+    uint16_t expected = 0;
+    // 300 rounds of 3 in, 3 out take the 8 bit indices around the wrap
+    for (int round = 0; round < 300; round++) {
+        for (int i = 0; i < 3; i++) {
+            if (!small.push(next++)) {
+                printf("ring: push refused with room left\n");
+                return false;
+            }
+        }
+        uint16_t value;
+        while (small.pop(&value)) {
+            if (value != expected++) {
+                printf("ring: got %u, expected %u\n", value, expected - 1);
+                return false;
+            }
+        }
+    }
+    for (uint16_t i = 0; i < 4; i++) {
+        small.push(i);
+    }
+    if (small.size() != 4 || small.push(4) || small.push(5) || small.getLost() != 2) {
+        printf("ring: full ring took a push, size %u lost %u\n", small.size(), small.getLost());
+        return false;
+    }
+    uint16_t first;
+    if (!small.pop(&first) || first != 0 || !small.push(6) || small.getLost() != 2) {
+        printf("ring: no room after a pop\n");
+        return false;
+    }
+
+    // A fixed schedule of bursts stands in for the interrupt and the
+    // main loop: the producer pushes up to 24 values at once, the
+    // consumer pops up to 24, so the ring runs both empty and full.
+    // Everything runs on one thread, as the interrupt and the loop do
+    // on the robot; a refused value is pushed again in a later burst.
+    Ring<uint32_t, 16> ring;
+    std::mt19937 schedule(19);
+    std::uniform_int_distribution<int> burst(0, 24);
+    const uint32_t count = 200000;
+    uint32_t sent = 0;
+    uint32_t received = 0;
+    uint32_t refused = 0;
+    bool inOrder = true;
+    while (received < count) {
+        for (int pushes = burst(schedule); pushes > 0 && sent < count; pushes--) {
+            if (ring.push(sent)) {
+                sent++;
+            } else {
+                refused++;
+            }
+        }
+        uint32_t value;
+        for (int pops = burst(schedule); pops > 0 && ring.pop(&value); pops--) {
+            inOrder = inOrder && value == received;
+            received++;
+        }
+    }
+    const uint8_t lost = refused < UINT8_MAX ? static_cast<uint8_t>(refused) : UINT8_MAX;
+    if (!inOrder || !ring.isEmpty()) {
+        printf("ring: values out of order or left over\n");
+        return false;
+    }
+    if (refused == 0 || ring.getLost() != lost) {
+        printf("ring: %u pushes refused, %u counted lost\n", refused, ring.getLost());
+        return false;
+    }
+    printf("ring: %u values through 16 slots in order, %u pushes refused while full\n", count, refused);
+    return true;
+}
+
+/*
+ * Checks that a saved tuning loads back as it was, and that an
+ * erased EEPROM or a record with a byte changed is refused without
+ * touching the tuning given.
+ */
+static bool checkSettings() {
+    Hal::Native::reset();
+    LineFollowing::Tuning loaded = LineFollowing::DEFAULT_TUNING;
+    if (Settings::load(&loaded)) {
+        printf("settings: loaded from an erased EEPROM\n");
+        return false;
+    }
+
+    LineFollowing::Tuning saved = LineFollowing::DEFAULT_TUNING;
+    saved.baseSpeed = 70;
+    saved.proportional = 91;
+    saved.integral = 12;
+    saved.derivativeFilter = 2;
+    Settings::save(saved);
+    if (!Settings::load(&loaded) || memcmp(&loaded, &saved, sizeof(saved)) != 0) {
+        printf("settings: saved tuning did not load back\n");
+        return false;
+    }
+
+    // every byte of the record, header, tuning or checksum, is checked
+    const LineFollowing::Tuning before = loaded;
+    for (uint16_t at = 0; at < 4 + sizeof(saved) + 1; at++) {
+        Hal::Native::Storage::memory[at] ^= 0x10;
+        const bool accepted = Settings::load(&loaded);
+        Hal::Native::Storage::memory[at] ^= 0x10;
+        if (accepted || memcmp(&loaded, &before, sizeof(before)) != 0) {
+            printf("settings: record with byte %u changed was loaded\n", at);
+            return false;
+        }
+    }
+    printf("settings: saved tuning loads back, erased and corrupted ones are refused\n");
+    return true;
+}
+
+/*
+ * Checks Pid's output limit, the clamp on its integral and its
+ * anti-windup: an integral that did not grow while the output was
+ * saturated leaves nothing to unwind when the error turns.
+ */
+static bool checkPid() {
+    // P only: the output stops at outputLimit either way
+    Pid proportional({256, 0, 0, 0, 0, 100});
+    if (proportional.update(0, 1000) != 100 || proportional.update(0, -1000) != -100 ||
+        proportional.update(0, 40) != 40) {
+        printf("pid: output not limited to 100\n");
+        return false;
+    }
+
+    // I only, 1/8 of the error per update: the term stops at
+    // integralLimit and comes straight back down from there
+    Pid integral({0, 8192, 0, 0, 50, 1000});
+    int16_t output = 0;
+    for (int i = 0; i < 100; i++) {
+        output = integral.update(0, 80);
+    }
+    const int16_t unwound = integral.update(0, -80);
+    if (output != 50 || unwound != 40) {
+        printf("pid: integral term %d, then %d, expected 50 then 40\n", output, unwound);
+        return false;
+    }
+
+    // P saturates the output for long; once the error turns, the
+    // output is the P term alone
+    Pid windup({256, 655, 0, 0, 1000, 100});
+    for (int i = 0; i < 1000; i++) {
+        windup.update(0, 500);
+    }
+    const int16_t turned = windup.update(0, -50);
+    if (turned != -50) {
+        printf("pid: after saturating, output %d on the turned error, expected -50\n", turned);
+        return false;
+    }
+    printf("pid: output limited, integral clamped, no windup while saturated\n");
+    return true;
+}
+
+/*
+ * Checks that SpeedGovernor only speeds up on a calm line: an error
+ * between GOVERNOR_CALM_ERROR and GOVERNOR_SLOW_ERROR slows it down
+ * to the speed for that error, but never raises it there.
+ */
+static bool checkGovernor() {
+    SpeedGovernor governor({50, 100, 80});
+    int16_t speed = 0;
+    for (int i = 0; i < 1000; i++) {
+        speed = governor.update(400);
+    }
+    if (speed != 50) {
+        printf("governor: %d after a steady error of 400 from 50, expected 50\n", speed);
+        return false;
+    }
+
+    for (int i = 0; i < 1000; i++) {
+        speed = governor.update(0);
+    }
+    const int16_t calm = speed;
+    for (int i = 0; i < 1000; i++) {
+        speed = governor.update(400);
+    }
+    // 100 - 50 * (400 - CALM) / (SLOW - CALM), as the governor works it out * 16
+    const int16_t expected = static_cast<int16_t>(
+        (100 * 16 - 50 * 16 * (400 - GOVERNOR_CALM_ERROR) / (GOVERNOR_SLOW_ERROR - GOVERNOR_CALM_ERROR)) / 16);
+    if (calm != 100 || speed != expected) {
+        printf("governor: %d on a calm line, then %d, expected 100 then %d\n", calm, speed, expected);
+        return false;
+    }
+    printf("governor: faster only on a calm line, %d at an error of 400\n", speed);
+    return true;
+}
+
+/*
+ * Checks which outer sensors Sensors::detectLines takes as the line,
+ * on frames as the robot would see them: a stripe beside a gap in the
+ * line is left out, the line going out under an outer sensor on a
+ * curve is not.
+ */
+static bool checkLineSensors() {
+#if LINE_POSITION_WIDE
+    struct Step {
+        const char *what;
+        uint16_t values[NUM_SENSORS];
+        bool detected;
+        int position; // -1 for none
+    };
+    // in order: the position the line was last seen at carries over
+    const Step steps[] = {
+        {"centred", {0, 0, 1000, 0, 0}, true, 2000},
+        {"stripe over a gap", {0, 0, 0, 0, 1000}, false, -1},
+        {"stripe beside the line", {1000, 0, 1000, 0, 0}, true, 2000},
+        {"curving right", {0, 0, 500, 1000, 0}, true, 2666},
+        {"further right", {0, 0, 0, 1000, 1000}, true, 3500},
+        {"under the right sensor alone", {0, 0, 0, 0, 1000}, true, 4000},
+        {"stripe on the other side", {1000, 0, 0, 0, 0}, false, -1},
+        {"back under the right sensor", {0, 0, 0, 0, 1000}, true, 4000},
+    };
+    for (const Step &step: steps) {
+        SensorFrame frame = {};
+        std::copy(step.values, step.values + NUM_SENSORS, frame.values);
+        const bool detected = Sensors::isLineDetected(frame);
+        const Option<int> position = Sensors::detectLines(frame);
+        const int found = position.checkState() == Some ? position.getValue() : -1;
+        if (detected != step.detected || found != step.position) {
+            printf("line sensors: %s: %s at %d, expected %s at %d\n", step.what,
+                   detected ? "line" : "no line", found, step.detected ? "line" : "no line", step.position);
+            return false;
+        }
+    }
+    printf("line sensors: stripes left out, the line followed out to an outer sensor\n");
+#endif
+    return true;
+}
+
+int main() {
+    bool ok = true;
+    ok &= benchmarkLex();
+    ok &= benchmarkClassifiers();
+    ok &= benchmarkCharacters();
+    ok &= benchmarkEdges();
+    ok &= checkRing();
+    ok &= checkSettings();
+    ok &= checkPid();
+    ok &= checkGovernor();
+    ok &= checkLineSensors();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,170 @@
+/**
+ * Native demo
+ *
+ * Drives the real Sensors, LineFollower, Scanner, KNNParser and
+ * BarcodeReader over a synthetic Code39 barcode on the simulated board, and
+ * prints what was decoded. Used to check that the scan/decode
+ * path builds and runs on a host.
+ *
+ * Usage: demo [trace file], which also writes the run's trace
+ * (see Trace.h) to the given file.
+ *
+ * Date: 2024-11-18
+ */
+
+#include <stdio.h>
+
+#include <string>
+
+#include "BarcodeReader.h"
+#include "Hal.h"
+#include "LineFollowing.h"
+#include "Parser.h"
+#include "Scanner.h"
+#include "Scheduler.h"
+#include "Sensors.h"
+#include "Trace.h"
+#include "code39.h"
+
+using namespace LineFollowing;
+using namespace Parser;
+using namespace Lab4;
+
+// Message printed between the two delimiters
+static const char *const MESSAGE = "*EEE243*";
+
+// Virtual time taken by one sensor frame
+static const uint32_t FRAME_PERIOD_US = 2000;
+
+// Widths of the elements and of the gap between characters
+static const uint32_t NARROW_US = 20000;
+static const uint32_t WIDE_US = 50000;
+static const uint32_t LEAD_IN_US = 100000;
+
+// Element edges of the barcode, in microseconds from the start
+static uint32_t edges[128];
+static int edgeCount = 0;
+
+/*
+ * Lays out the bars of MESSAGE from the current virtual time.
+ * Every character is 9 elements starting with a bar, followed
+ * by a narrow gap.
+ */
+static void buildBarcode() {
+    uint32_t t = Hal::Native::Clock::now + LEAD_IN_US;
+    for (const char *c = MESSAGE; *c != '\0'; c++) {
+        for (auto row: code39) {
+            if (row[0] != *c) {
+                continue;
+            }
+            for (int i = 1; i <= WIDTH_CHARACTER_SIZE; i++) {
+                edges[edgeCount++] = t;
+                t += row[i] == Wide ? WIDE_US : NARROW_US;
+            }
+            edges[edgeCount++] = t;
+            t += NARROW_US;
+        }
+    }
+}
+
+/*
+ * Sensor frame at the current virtual time. The robot drives at a
+ * constant speed, the centre sensor is always on the line, the outer
+ * pair sees the barcode, and the line ends shortly after the last
+ * character.
+ */
+static void readFrame(uint16_t values[NUM_SENSORS]) {
+    Hal::Native::Clock::advance(FRAME_PERIOD_US);
+    const uint32_t now = Hal::Native::Clock::now;
+
+    // one encoder count per millisecond on both wheels
+    Hal::Native::Encoders::left = static_cast<int16_t>(now / 1000);
+    Hal::Native::Encoders::right = static_cast<int16_t>(now / 1000);
+
+    int crossed = 0;
+    while (crossed < edgeCount && edges[crossed] <= now) {
+        crossed++;
+    }
+    const bool onLine = edgeCount == 0 || now < edges[edgeCount - 1] + LEAD_IN_US;
+    const uint16_t stripe = crossed % 2 == 1 ? 1000 : 0;
+
+    memset(values, 0, NUM_SENSORS * sizeof(uint16_t));
+    values[2] = onLine ? 1000 : 0;
+    values[BARCODE_SENSOR_LEFT] = stripe;
+    values[BARCODE_SENSOR_RIGHT] = stripe;
+}
+
+// Receives the trace, if one was asked for
+static FILE *traceFile = nullptr;
+
+static void writeTrace(const uint8_t *data, const uint16_t size) {
+    fwrite(data, 1, size, traceFile);
+}
+
+// Control ticks, timed the same way as on the robot
+static Scheduler scheduler(CONTROL_PERIOD);
+
+/*
+ * One control tick, as in main.cpp.
+ */
+static Option<Bar> tick(Scanner &scanner, LineFollower &driver) {
+    static SensorFrame frame = {};
+    scheduler.waitForTick();
+    if (!scheduler.run(0, [] { return Sensors::acquire(&frame); })) {
+        return {};
+    }
+    scheduler.run(1, [&driver] { driver.follow(frame); });
+    Option<Bar> result = scheduler.run(2, [&scanner] { return scanner.scan(frame); });
+    Trace::record(frame, driver.getLeftSpeed(), driver.getRightSpeed());
+    Trace::flush();
+    return result;
+}
+
+int main(const int argc, const char *argv[]) {
+    Hal::Native::reset();
+    Hal::Native::LineSensors::source = readFrame;
+    if (argc > 1) {
+        traceFile = fopen(argv[1], "wb");
+        if (traceFile == nullptr) {
+            printf("error: cannot write %s\n", argv[1]);
+            return 1;
+        }
+        Hal::Native::SerialPort::sink = writeTrace;
+    }
+
+    LineFollower driver;
+    KNNParser parser(CLASSIFIER_STRATEGY);
+    driver.calibrate();
+    driver.follow(SensorFrame{});
+    driver.start();
+    scheduler.begin();
+    Trace::begin();
+    buildBarcode();
+
+    BarcodeReader::Result result;
+    const BarcodeReader::Status status = BarcodeReader::read(driver, parser, tick, &result);
+    std::string outcome;
+    if (status == BarcodeReader::Decoded) {
+        printf("decoded: %s\n", result.buffer);
+        outcome = std::string("result ") + result.buffer;
+    } else {
+        printf("error: %s\n", BarcodeReader::describe(status));
+        outcome = std::string("error ") + BarcodeReader::describe(status);
+    }
+
+    // frames take virtual time to read, so only sensing shows up here
+    const char *const names[] = {"sense", "follow", "scan"};
+    for (uint8_t task = 0; task < 3; task++) {
+        const Scheduler::TaskStats &stats = scheduler.getStats(task);
+        printf("%-6s runs %u mean %uus max %uus overruns %u\n", names[task], stats.runs,
+               Scheduler::toMicros(stats.mean()), Scheduler::toMicros(stats.max), stats.overruns);
+    }
+    printf("missed ticks %u\n", scheduler.getMissedTicks());
+
+    if (traceFile != nullptr) {
+        Trace::note(outcome.c_str());
+        Trace::flush();
+        fclose(traceFile);
+    }
+    return status == BarcodeReader::Decoded ? 0 : 1;
+}
@@ -0,0 +1,166 @@
+/**
+ * Replay
+ *
+ * Feeds recorded runs (see FrameFile.h) through the real Sensors,
+ * LineFollower, Scanner, KNNParser and BarcodeReader on the
+ * simulated board, with virtual time taken from the frames, and
+ * checks that every run ends the way the robot's did.
+ *
+ * Usage: replay <frame file>...
+ *
+ * Prints one line per run and a summary, and exits with 1 if any
+ * run ended differently.
+ *
+ * Date: 2024-11-23
+ */
+
+#include <stdio.h>
+
+#include <chrono>
+
+#include "BarcodeReader.h"
+#include "FrameFile.h"
+#include "Hal.h"
+#include "Sensors.h"
+
+using namespace LineFollowing;
+using namespace Parser;
+using namespace Lab4;
+
+// Run being replayed and the next frame of it
+static const FrameFile::Run *replaying = nullptr;
+static size_t nextFrame = 0;
+
+// The reader wanted more frames than were recorded
+static bool exhausted = false;
+
+/*
+ * Hands out the next recorded frame, with the board's clock and
+ * encoders moved to where they were when it was taken. Frames
+ * past the end of the run are all white.
+ */
+static void readFrame(uint16_t values[NUM_SENSORS]) {
+    if (nextFrame >= replaying->frames.size()) {
+        exhausted = true;
+        memset(values, 0, NUM_SENSORS * sizeof(uint16_t));
+        return;
+    }
+    const Trace::Sample &sample = replaying->frames[nextFrame++];
+    Hal::Native::Clock::now = sample.timestamp;
+    Hal::Native::Encoders::left = sample.countsLeft;
+    Hal::Native::Encoders::right = sample.countsRight;
+    memcpy(values, sample.values, NUM_SENSORS * sizeof(uint16_t));
+}
+
+/*
+ * One control tick, as in main.cpp.
+ */
+static Option<Bar> tick(Scanner &scanner, LineFollower &driver) {
+    static SensorFrame frame = {};
+    if (!Sensors::acquire(&frame)) {
+        return {};
+    }
+    driver.follow(frame);
+    return scanner.scan(frame);
+}
+
+/*
+ * Replays the run and returns how it ended, written the same way
+ * as the robot's outcome ("result ..." or "error ...").
+ */
+static std::string replay(const FrameFile::Run &run) {
+    Hal::Native::reset();
+    Hal::Native::LineSensors::source = readFrame;
+    replaying = &run;
+    nextFrame = 0;
+    exhausted = false;
+
+    LineFollower driver;
+    KNNParser parser(CLASSIFIER_STRATEGY);
+    driver.calibrate();
+    driver.follow(SensorFrame{});
+
+    // start where the robot was when the run started
+    if (!run.frames.empty()) {
+        Hal::Native::Clock::now = run.frames[0].timestamp;
+        Hal::Native::Encoders::left = run.frames[0].countsLeft;
+        Hal::Native::Encoders::right = run.frames[0].countsRight;
+    }
+    driver.start();
+
+    BarcodeReader::Result result;
+    const BarcodeReader::Status status = BarcodeReader::read(driver, parser, tick, &result);
+    std::string outcome;
+    if (status == BarcodeReader::Decoded) {
+        outcome = result.buffer[0] == '\0' ? "result" : std::string("result ") + result.buffer;
+    } else {
+        outcome = std::string("error ") + BarcodeReader::describe(status);
+    }
+    if (exhausted) {
+        outcome += " (after the recorded frames)";
+    }
+    return outcome;
+}
+
+int main(const int argc, const char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <frame file>...\n", argv[0]);
+        return 2;
+    }
+
+    int runs = 0;
+    int matched = 0;
+    int unchecked = 0;
+    uint64_t frames = 0;
+    double recorded = 0;
+    double replayed = 0;
+
+    for (int i = 1; i < argc; i++) {
+        std::vector<FrameFile::Run> file;
+        std::string error;
+        if (!FrameFile::load(argv[i], &file, &error)) {
+            fprintf(stderr, "%s: %s\n", argv[i], error.c_str());
+            return 2;
+        }
+
+        for (const FrameFile::Run &run: file) {
+            const auto start = std::chrono::steady_clock::now();
+            const std::string outcome = replay(run);
+            replayed += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            runs++;
+            frames += run.frames.size();
+            if (!run.frames.empty()) {
+                recorded += (run.frames.back().timestamp - run.frames.front().timestamp) / 1e6;
+            }
+
+            const char *verdict;
+            if (run.outcome.empty()) {
+                verdict = "no recorded outcome";
+                unchecked++;
+            } else if (outcome == run.outcome) {
+                verdict = "same";
+                matched++;
+            } else {
+                verdict = "DIFFERENT";
+            }
+            printf("%s:%d: %s [%s", argv[i], run.line, outcome.c_str(), verdict);
+            if (outcome != run.outcome && !run.outcome.empty()) {
+                printf(", robot: %s", run.outcome.c_str());
+            }
+            if (run.dropped != 0) {
+                printf(", %u records dropped", run.dropped);
+            }
+            printf("]\n");
+        }
+    }
+
+    const int different = runs - matched - unchecked;
+    printf("%d runs: %d same, %d different, %d unchecked; %llu frames, %.1f s recorded replayed in %.3f s",
+           runs, matched, different, unchecked, static_cast<unsigned long long>(frames), recorded, replayed);
+    if (replayed > 0) {
+        printf(" (%.0fx real time)", recorded / replayed);
+    }
+    printf("\n");
+    return different == 0 ? 0 : 1;
+}
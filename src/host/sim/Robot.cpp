@@ -0,0 +1,67 @@
+#include "Robot.h"
+
+#include <algorithm>
+#include <cmath>
+
+/**
+ * Robot
+ *
+ * Kinematic model of the 3pi+ 32U4 on a Track.
+ *
+ * Date: 2024-11-24
+ *
+ */
+
+Robot::Robot(const Track &track, const double x, const double y, const double heading, const double noise,
+             const uint32_t seed)
+    : x(x), y(y), heading(heading), track(track), noise(noise), random(seed), gaussian(0, 1) {
+}
+
+/*
+ * Moves on for dt seconds with the given motor commands.
+ */
+void Robot::step(const double dt, const int16_t leftCommand, const int16_t rightCommand) {
+    if (dt != lastStep) {
+        follow = 1 - std::exp(-dt / MOTOR_LAG);
+        lastStep = dt;
+    }
+    leftSpeed += (leftCommand * MM_PER_S_PER_UNIT - leftSpeed) * follow;
+    rightSpeed += (rightCommand * MM_PER_S_PER_UNIT - rightSpeed) * follow;
+
+    const double speed = (leftSpeed + rightSpeed) / 2;
+    const double turn = (rightSpeed - leftSpeed) / WHEEL_BASE;
+    const double midHeading = heading + turn * dt / 2;
+    x += speed * dt * std::cos(midHeading);
+    y += speed * dt * std::sin(midHeading);
+    heading += turn * dt;
+    leftDistance += leftSpeed * dt;
+    rightDistance += rightSpeed * dt;
+}
+
+/*
+ * Calibrated (0 - 1000) values of the sensors where the robot is.
+ */
+void Robot::sense(uint16_t values[NUM_SENSORS]) {
+    const double forwardX = std::cos(heading);
+    const double forwardY = std::sin(heading);
+    for (int i = 0; i < NUM_SENSORS; i++) {
+        // sensor 0 is on the left, i.e. towards +y when heading along x
+        const double side = (NUM_SENSORS / 2 - i) * SENSOR_SPACING;
+        const double sx = x + SENSOR_AHEAD * forwardX - side * forwardY;
+        const double sy = y + SENSOR_AHEAD * forwardY + side * forwardX;
+        double value = (255 - track.grey(sx, sy, SENSOR_RADIUS)) * 1000 / 255;
+        if (noise > 0) {
+            value += noise * gaussian(random);
+        }
+        values[i] = static_cast<uint16_t>(std::lround(std::min(1000.0, std::max(0.0, value))));
+    }
+}
+
+// Encoder counts, wrapping around like the real ones
+int16_t Robot::countsLeft() const {
+    return static_cast<int16_t>(static_cast<int32_t>(std::lround(leftDistance * COUNTS_PER_MM)));
+}
+
+int16_t Robot::countsRight() const {
+    return static_cast<int16_t>(static_cast<int32_t>(std::lround(rightDistance * COUNTS_PER_MM)));
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <stdint.h>
+
+#include <random>
+
+#include "Lab4.h"
+#include "Track.h"
+
+/**
+ * Robot
+ *
+ * Kinematic model of the 3pi+ 32U4 on a Track: two driven
+ * wheels whose speeds follow the motor commands with a lag, the
+ * wheel encoders, and the 5 reflectance sensors in a row ahead
+ * of the axle, sensor 0 (BARCODE_SENSOR_LEFT) on the left.
+ *
+ * The dimensions are those of the Standard Edition (30:1 motors)
+ * to within a few millimetres; the motor lag is a first order
+ * estimate.
+ *
+ * Date: 2024-11-24
+ *
+ */
+
+class Robot {
+public:
+    // Distance between the wheels' contact points (mm)
+    static constexpr double WHEEL_BASE = 87;
+    // Encoder counts per mm travelled by a wheel: 12 counts per
+    // motor turn, 29.86:1 gearbox, 32 mm wheels
+    static constexpr double COUNTS_PER_MM = 12 * 29.86 / (3.14159265 * 32);
+    // Wheel speed (mm/s) per unit of motor command (-400 - 400)
+    static constexpr double MM_PER_S_PER_UNIT = 1500.0 / 400;
+    // Time constant of the wheel speed following its command (s)
+    static constexpr double MOTOR_LAG = 0.03;
+    // Sensors: distance ahead of the axle, between neighbours, and
+    // radius of the patch of floor each one sees (mm)
+    static constexpr double SENSOR_AHEAD = 30;
+    static constexpr double SENSOR_SPACING = 16;
+    static constexpr double SENSOR_RADIUS = 2;
+
+    // Pose on the track (mm, radians, counter-clockwise from x)
+    double x;
+    double y;
+    double heading;
+
+    /*
+     * Robot standing still at the pose. Reflectance noise is the
+     * standard deviation of the calibrated values (0 - 1000).
+     */
+    Robot(const Track &track, double x, double y, double heading, double noise, uint32_t seed);
+
+    /*
+     * Moves on for dt seconds with the given motor commands.
+     */
+    void step(double dt, int16_t leftCommand, int16_t rightCommand);
+
+    /*
+     * Calibrated (0 - 1000) values of the sensors where the robot is.
+     */
+    void sense(uint16_t values[NUM_SENSORS]);
+
+    // Track the robot drives over
+    const Track &getTrack() const {
+        return track;
+    }
+
+    // Encoder counts, wrapping around like the real ones
+    int16_t countsLeft() const;
+
+    int16_t countsRight() const;
+
+private:
+    const Track &track;
+    double leftSpeed = 0;
+    double rightSpeed = 0;
+    double leftDistance = 0;
+    double rightDistance = 0;
+    // How far the wheel speeds close on their commands in one step of lastStep seconds
+    double follow = 0;
+    double lastStep = 0;
+    const double noise;
+    std::mt19937 random;
+    std::normal_distribution<double> gaussian;
+};
@@ -0,0 +1,209 @@
+#include "Track.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+#include "Lab4.h"
+#include "code39.h"
+
+/**
+ * Track
+ *
+ * Rasterised track the simulated robot drives over.
+ *
+ * Date: 2024-11-24
+ *
+ */
+
+// 19 mm electrical tape, stripes clear of it out to past the outer sensors
+const Track::Print Track::DEFAULT_PRINT = {19, 6, 2.5, 0, 24, 50, 200, 200, 0, 0, 0, 1, 0, 0, 100};
+
+Track::Track(const int width, const int height, const double mmPerPixel)
+    : width(width), height(height), mmPerPixel(mmPerPixel), pixels(width * height, 255) {
+}
+
+/*
+ * Centre line with message as Code39 stripes on both sides of
+ * it, each character followed by a narrow space. The line is
+ * straight but for the bend at the start of the lead-in.
+ * Returns false if a character is not in Code39.
+ */
+bool Track::barcode(const std::string &message, const Print &print, const double mmPerPixel, Track *track) {
+    const double wide = print.narrow * print.ratio;
+
+    // lay the elements out first to know how long the track is
+    std::vector<double> bars; // start and end of every bar
+    double x = print.leadIn;
+    for (const char c: message) {
+        const char *pattern = nullptr;
+        for (const auto &row: code39) {
+            if (row[0] == c) {
+                pattern = row + 1;
+            }
+        }
+        if (pattern == nullptr) {
+            return false;
+        }
+        for (int i = 0; i < WIDTH_CHARACTER_SIZE; i++) {
+            const double element = pattern[i] == Lab4::Wide ? wide : print.narrow;
+            if (i % 2 == 0) {
+                bars.push_back(x - print.spread / 2);
+                bars.push_back(x + element + print.spread / 2);
+            }
+            x += element;
+        }
+        x += print.narrow;
+    }
+
+    const double length = x + print.leadOut;
+    const double reach = std::max(print.stripeOuter, std::fabs(print.bend) + print.lineWidth);
+    *track = Track(static_cast<int>(std::ceil(length / mmPerPixel)),
+                   static_cast<int>(std::ceil(2 * (reach + 20) / mmPerPixel)), mmPerPixel);
+    track->bend = print.bend;
+    track->bendLength = std::min(print.bendLength, print.leadIn);
+    if (print.bend == 0) {
+        track->fill(0, length, -print.lineWidth / 2, print.lineWidth / 2, print.ink);
+    } else {
+        // one column at a time through the bend, as wide across the
+        // line as the straight part is
+        const double bendLength = track->bendLength;
+        for (double x0 = 0; x0 < bendLength; x0 += mmPerPixel) {
+            const double middle = x0 + mmPerPixel / 2;
+            const double slope = -print.bend * M_PI / (2 * bendLength) * std::sin(M_PI * middle / bendLength);
+            const double half = print.lineWidth / 2 * std::sqrt(1 + slope * slope);
+            const double y = track->centre(middle);
+            track->fill(x0, x0 + mmPerPixel, y - half, y + half, print.ink);
+        }
+        track->fill(bendLength, length, -print.lineWidth / 2, print.lineWidth / 2, print.ink);
+    }
+    if (print.gap > 0) {
+        const double middle = (print.leadIn + x) / 2;
+        track->fill(middle - print.gap / 2, middle + print.gap / 2, -print.lineWidth / 2, print.lineWidth / 2, 255);
+    }
+    const double slant = std::tan(print.slant * M_PI / 180);
+    std::mt19937 random(print.seed);
+    std::uniform_real_distribution<double> chance(0, 1);
+    for (size_t i = 0; i < bars.size(); i += 2) {
+        track->fill(bars[i], bars[i + 1], print.stripeInner, print.stripeOuter, print.ink, slant);
+        if (chance(random) >= print.missing) {
+            track->fill(bars[i], bars[i + 1], -print.stripeOuter, -print.stripeInner, print.ink, slant);
+        }
+    }
+    return true;
+}
+
+/*
+ * Reads a binary (P5) PGM image. Returns false if it cannot.
+ */
+bool Track::load(const char *path, const double mmPerPixel, Track *track, std::string *error) {
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr) {
+        *error = std::string("cannot read ") + path;
+        return false;
+    }
+    int width = 0;
+    int height = 0;
+    int maximum = 0;
+    const bool header = fscanf(file, "P5 %d %d %d", &width, &height, &maximum) == 3 && fgetc(file) != EOF;
+    if (!header || width <= 0 || height <= 0 || maximum != 255) {
+        *error = std::string(path) + " is not an 8 bit binary PGM image";
+        fclose(file);
+        return false;
+    }
+    *track = Track(width, height, mmPerPixel);
+    const size_t read = fread(track->pixels.data(), 1, track->pixels.size(), file);
+    fclose(file);
+    if (read != track->pixels.size()) {
+        *error = std::string(path) + " is cut off";
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Writes the track as a binary (P5) PGM image.
+ */
+bool Track::save(const char *path) const {
+    FILE *file = fopen(path, "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    fprintf(file, "P5\n%d %d\n255\n", width, height);
+    const bool ok = fwrite(pixels.data(), 1, pixels.size(), file) == pixels.size();
+    return fclose(file) == 0 && ok;
+}
+
+/*
+ * Mean grey level (0 - 255) over a disc of the given radius
+ * around (x, y); off the image counts as white.
+ */
+double Track::grey(const double x, const double y, const double radius) const {
+    if (radius != discRadius) {
+        // pixel offsets covered by the disc, worked out once per radius
+        const double reach = radius / mmPerPixel;
+        const int span = static_cast<int>(std::ceil(reach));
+        disc.clear();
+        for (int dy = -span; dy <= span; dy++) {
+            for (int dx = -span; dx <= span; dx++) {
+                if (dx * dx + dy * dy <= reach * reach) {
+                    disc.push_back({dx, dy});
+                }
+            }
+        }
+        discSpan = span;
+        discRadius = radius;
+    }
+
+    const int column = static_cast<int>(std::floor(x / mmPerPixel));
+    const int row = static_cast<int>(std::floor(height / 2.0 - y / mmPerPixel));
+    const bool inside = column - discSpan >= 0 && column + discSpan < width &&
+                        row - discSpan >= 0 && row + discSpan < height;
+
+    uint32_t total = 0;
+    if (inside) {
+        const uint8_t *centre = &pixels[row * width + column];
+        for (const auto &offset: disc) {
+            total += centre[offset.second * width + offset.first];
+        }
+    } else {
+        for (const auto &offset: disc) {
+            const int c = column + offset.first;
+            const int r = row + offset.second;
+            total += c >= 0 && c < width && r >= 0 && r < height ? pixels[r * width + c] : 255;
+        }
+    }
+    return static_cast<double>(total) / disc.size();
+}
+
+// Length of the track along x (mm)
+double Track::length() const {
+    return width * mmPerPixel;
+}
+
+/*
+ * Middle of the centre line at x (mm).
+ */
+double Track::centre(const double x) const {
+    if (bend == 0 || x >= bendLength) {
+        return 0;
+    }
+    return bend * (1 + std::cos(M_PI * std::max(x, 0.0) / bendLength)) / 2;
+}
+
+// Paints x0 - x1, y0 - y1 (mm) with the grey level
+void Track::fill(const double x0, const double x1, const double y0, const double y1, const uint8_t level,
+                 const double slant) {
+    const int r0 = std::max(0, static_cast<int>(std::lround(height / 2.0 - y1 / mmPerPixel)));
+    const int r1 = std::min(height, static_cast<int>(std::lround(height / 2.0 - y0 / mmPerPixel)));
+    for (int r = r0; r < r1; r++) {
+        const double shift = slant * (height / 2.0 - r) * mmPerPixel;
+        const int c0 = std::max(0, static_cast<int>(std::lround((x0 + shift) / mmPerPixel)));
+        const int c1 = std::min(width, static_cast<int>(std::lround((x1 + shift) / mmPerPixel)));
+        for (int c = c0; c < c1; c++) {
+            pixels[r * width + c] = level;
+        }
+    }
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include <stdint.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Track
+ *
+ * Rasterised track the simulated robot drives over: a grey
+ * image where 0 is black tape or ink and 255 is white floor.
+ * The x axis runs along the image rows from the left edge, the
+ * y axis up from the middle row, both in millimetres.
+ *
+ * Date: 2024-11-24
+ *
+ */
+
+class Track {
+public:
+    // How a barcode track is printed
+    typedef struct {
+        double lineWidth; // width of the centre line (mm)
+        double narrow; // width of a narrow element (mm)
+        double ratio; // wide / narrow
+        double spread; // ink spread, added to every bar and taken off every space (mm)
+        double stripeInner; // distance of the stripes from the centre (mm)
+        double stripeOuter; // distance of the stripes' far ends from the centre (mm)
+        double leadIn; // line before the first bar (mm)
+        double leadOut; // line after the last bar (mm)
+        uint8_t ink; // grey level of the line and bars, 0 is fully black
+        double slant; // angle of the stripes away from square to the line (degrees)
+        double missing; // share of the bars left out on the right side (0 - 1)
+        uint32_t seed; // picks the bars left out
+        double gap; // break in the centre line halfway along the barcode (mm)
+        double bend; // sideways start of the line, which curves back to the middle (mm)
+        double bendLength; // along the lead-in, from its start (mm)
+    } Print;
+
+    static const Print DEFAULT_PRINT;
+
+    Track(int width, int height, double mmPerPixel);
+
+    /*
+     * Centre line with message as Code39 stripes on both sides of
+     * it, each character followed by a narrow space. The line is
+     * straight but for the bend of the lead-in (see centre).
+     * Returns false if a character is not in Code39.
+     */
+    static bool barcode(const std::string &message, const Print &print, double mmPerPixel, Track *track);
+
+    /*
+     * Reads a binary (P5) PGM image. Returns false if it cannot.
+     */
+    static bool load(const char *path, double mmPerPixel, Track *track, std::string *error);
+
+    /*
+     * Writes the track as a binary (P5) PGM image.
+     */
+    bool save(const char *path) const;
+
+    /*
+     * Mean grey level (0 - 255) over a disc of the given radius
+     * around (x, y); off the image counts as white.
+     */
+    double grey(double x, double y, double radius) const;
+
+    // Length of the track along x (mm)
+    double length() const;
+
+    /*
+     * Middle of the centre line at x (mm). An S bend from y = bend
+     * at the start, half a cosine wave long bendLength, 0 from there
+     * on and on tracks loaded from an image.
+     */
+    double centre(double x) const;
+
+private:
+    int width;
+    int height;
+    double mmPerPixel;
+    std::vector<uint8_t> pixels;
+    double bend = 0;
+    double bendLength = 0;
+
+    // Pixel offsets of the disc last asked for by grey()
+    mutable std::vector<std::pair<int, int>> disc;
+    mutable double discRadius = -1;
+    mutable int discSpan = 0;
+
+    // Paints x0 - x1, y0 - y1 (mm) with the grey level, moving
+    // every row along x by `slant` mm per mm of y
+    void fill(double x0, double x1, double y0, double y1, uint8_t level, double slant = 0);
+};
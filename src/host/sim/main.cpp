@@ -0,0 +1,426 @@
+/**
+ * Simulator
+ *
+ * Runs the real LineFollower and BarcodeReader closed loop against
+ * a kinematic model of the robot (see Robot.h) driving over a
+ * rasterised track (see Track.h), on the simulated board with a
+ * fixed-rate control tick as on the robot.
+ *
+ * Usage: sim [options]
+ *   --message TEXT     barcode to print, with its delimiters ("*EEE243*")
+ *   --track FILE       drive over a PGM image instead (0.5 mm per pixel)
+ *   --write-track FILE save the track as a PGM image
+ *   --speed N          base (and top) motor speed (BASE_SPEED)
+ *   --top N            top speed on a calm line, after --speed (MAX_SPEED)
+ *   --kp N, --kd N     PD gains * 256 (PROPORTIONAL/DERIVATIVE_CONSTANT)
+ *   --ki N             integral gain * 65536 (0)
+ *   --kff N            curvature feed-forward gain * 256 (0)
+ *   --dfilter N        derivative low-pass, 2^N frames (0)
+ *   --narrow MM        narrow element width (6)
+ *   --ratio R          wide / narrow (2.5)
+ *   --spread MM        ink spread of the bars (0)
+ *   --ink N            grey level of the ink, 0 is black (0)
+ *   --slant DEG        stripes printed at an angle to square (0)
+ *   --missing P        share of bars missing on the right side (0)
+ *   --gap MM           break in the centre line halfway along the barcode (0)
+ *   --bend MM          start the line this far to the left, curving back
+ *                      to the middle in an S bend at the start (0)
+ *   --bend-length MM   length of that S bend, at most the lead-in (100)
+ *   --lead-in MM       line before the first bar (200)
+ *   --noise N          sensor noise, std dev of the 0 - 1000 values (0)
+ *   --offset MM        start off the line sideways (0)
+ *   --angle DEG        start at an angle to the line (0)
+ *   --seed N           noise seed (1)
+ *   --sweep            run every combination of a few speeds, gains
+ *                      and noise levels instead, one line each
+ *   --autotune RULE    tune the gains for the top speed with a relay
+ *                      experiment (see AutoTune.h) by rule pd or pid,
+ *                      then read the track with them from the offset
+ *                      and angle (8 mm and 10 degrees if not given)
+ *                      and check that the robot settles on the line
+ *
+ * Prints what was read, the largest distance from the centre line
+ * and how much faster than real time the run was simulated.
+ * Exits with 1 if the track was not read or, when auto-tuning,
+ * the robot did not settle.
+ *
+ * Date: 2024-11-24
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <cmath>
+#include <string>
+
+#include "AutoTune.h"
+#include "BarcodeReader.h"
+#include "Hal.h"
+#include "Robot.h"
+#include "Scheduler.h"
+#include "Sensors.h"
+#include "Track.h"
+
+using namespace LineFollowing;
+using namespace Parser;
+using namespace Lab4;
+
+// Longest a run may take in virtual time (us)
+static const uint32_t TIME_LIMIT = 60 * 1000000UL;
+
+// Longest physics step (us)
+static const uint32_t STEP = 250;
+
+// Time (us) after which the robot should have settled on the line,
+// and how far it may then still swing from side to side (mm). It
+// may settle off centre: the centre sensor sees a line as wide as
+// the tape anywhere within a few mm of it.
+static const uint32_t SETTLE_TIME = 1000000;
+static const double SETTLED_SWING = 2;
+
+// Length of the plain line the relay experiment runs on (mm)
+static const double EXPERIMENT_LINE = 10000;
+
+typedef struct {
+    std::string message = "*EEE243*";
+    const char *trackFile = nullptr;
+    const char *writeTrack = nullptr;
+    Tuning tuning = DEFAULT_TUNING;
+    Track::Print print = Track::DEFAULT_PRINT;
+    double noise = 0;
+    double offset = 0;
+    double angle = 0;
+    uint32_t seed = 1;
+    bool sweep = false;
+    bool autoTune = false;
+    AutoTune::Rule rule = AUTOTUNE_RULE;
+} Options;
+
+typedef struct {
+    std::string outcome;
+    double worstOffset; // largest distance from the middle of the line seen (mm)
+    double swing; // largest minus smallest of that distance, with its side, after SETTLE_TIME (mm)
+    double seconds; // virtual time of the run
+    double wall; // time taken to simulate it
+} Outcome;
+
+// Robot being simulated and the virtual time it has been moved to
+static Robot *robot = nullptr;
+static uint32_t simulatedTo = 0;
+static double worstOffset = 0;
+static double settledLow = 0;
+static double settledHigh = 0;
+
+/*
+ * Moves the robot up to the board's current time with the motor
+ * commands latched by the HAL, then reads its sensors. Past the
+ * time limit the sensors see only white, which ends the run.
+ */
+static void readFrame(uint16_t values[NUM_SENSORS]) {
+    const uint32_t now = Hal::Native::Clock::now;
+    while (static_cast<int32_t>(now - simulatedTo) > 0) {
+        const uint32_t dt = now - simulatedTo < STEP ? now - simulatedTo : STEP;
+        robot->step(dt / 1e6, Hal::Native::Motors::left, Hal::Native::Motors::right);
+        simulatedTo += dt;
+        const double offset = robot->y - robot->getTrack().centre(robot->x);
+        worstOffset = std::max(worstOffset, std::fabs(offset));
+        if (simulatedTo <= SETTLE_TIME) {
+            settledLow = offset;
+            settledHigh = offset;
+        }
+        settledLow = std::min(settledLow, offset);
+        settledHigh = std::max(settledHigh, offset);
+    }
+    Hal::Native::Encoders::left = robot->countsLeft();
+    Hal::Native::Encoders::right = robot->countsRight();
+
+    if (now > TIME_LIMIT) {
+        memset(values, 0, NUM_SENSORS * sizeof(uint16_t));
+        return;
+    }
+    robot->sense(values);
+}
+
+static Scheduler scheduler(CONTROL_PERIOD);
+
+/*
+ * One control tick, as in main.cpp.
+ */
+static Option<Bar> tick(Scanner &scanner, LineFollower &driver) {
+    static SensorFrame frame = {};
+    scheduler.waitForTick();
+    if (!Sensors::acquire(&frame)) {
+        return {};
+    }
+    driver.follow(frame);
+    return scanner.scan(frame);
+}
+
+/*
+ * Puts the model at the start of the track, with the driver
+ * calibrated and following from rest at time 0.
+ */
+static void place(Robot *model, LineFollower &driver, const Tuning &tuning) {
+    robot = model;
+    simulatedTo = 0;
+    worstOffset = 0;
+    Hal::Native::LineSensors::source = readFrame;
+
+    driver.setTuning(tuning);
+    driver.calibrate();
+    driver.follow(SensorFrame{});
+
+    // calibration only moves the clock here; start from rest at time 0
+    Hal::Native::Clock::now = 0;
+    driver.start();
+    scheduler.begin();
+}
+
+/*
+ * Drives the robot from the start of the track until the reader
+ * is done.
+ */
+static Outcome simulate(const Track &track, const Options &options) {
+    Hal::Native::reset();
+    Robot model(track, 0, track.centre(0) + options.offset, options.angle * M_PI / 180, options.noise, options.seed);
+    const auto start = std::chrono::steady_clock::now();
+    LineFollower driver;
+    KNNParser parser(CLASSIFIER_STRATEGY);
+    place(&model, driver, options.tuning);
+
+    BarcodeReader::Result result;
+    const BarcodeReader::Status status = BarcodeReader::read(driver, parser, tick, &result);
+    driver.stop();
+
+    Outcome outcome;
+    if (status == BarcodeReader::Decoded) {
+        outcome.outcome = std::string("result ") + result.buffer;
+    } else {
+        outcome.outcome = std::string("error ") + BarcodeReader::describe(status);
+    }
+    if (Hal::Native::Clock::now > TIME_LIMIT) {
+        outcome.outcome += " (timed out)";
+    }
+    outcome.worstOffset = worstOffset;
+    outcome.swing = settledHigh - settledLow;
+    outcome.seconds = Hal::Native::Clock::now / 1e6;
+    outcome.wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    robot = nullptr;
+    return outcome;
+}
+
+/*
+ * Runs every combination of a few speeds, gains and noise levels.
+ */
+static void sweep(const Track &track, Options options) {
+    const int16_t speeds[] = {30, 50, 80, 120};
+    const int16_t proportionals[] = {32, 64, 128};
+    const int16_t derivatives[] = {128, 256, 512};
+    const double noises[] = {0, 20, 50};
+
+    printf("speed   kp   kd noise  worst mm  time s  outcome\n");
+    for (const int16_t speed: speeds) {
+        for (const int16_t proportional: proportionals) {
+            for (const int16_t derivative: derivatives) {
+                for (const double noise: noises) {
+                    options.tuning.baseSpeed = speed;
+                    options.tuning.maxSpeed = speed;
+                    options.tuning.proportional = proportional;
+                    options.tuning.derivative = derivative;
+                    options.noise = noise;
+                    const Outcome outcome = simulate(track, options);
+                    printf("%5d %4d %4d %5.0f %9.1f %7.2f  %s\n", speed, proportional, derivative, noise,
+                           outcome.worstOffset, outcome.seconds, outcome.outcome.c_str());
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Runs the relay experiment along a plain line, at the speed of
+ * the options' tuning. Returns false if the line ended first.
+ */
+static bool experiment(const Options &options, AutoTune::Result *result) {
+    const Tuning &tuning = options.tuning;
+    Track::Print print = Track::DEFAULT_PRINT;
+    print.leadIn = EXPERIMENT_LINE;
+    Track line(1, 1, 0.5);
+    Track::barcode("", print, 0.5, &line);
+
+    Hal::Native::reset();
+    Robot model(line, 0, 0, 0, options.noise, options.seed);
+    LineFollower driver;
+    place(&model, driver, tuning);
+
+    AutoTune::RelayExperiment relay(AutoTune::relayFor(tuning));
+    driver.setRelay(AutoTune::relayFor(tuning));
+    SensorFrame frame = {};
+    while (!relay.isDone() && driver.getState() == Following) {
+        scheduler.waitForTick();
+        if (!Sensors::acquire(&frame)) {
+            continue;
+        }
+        driver.follow(frame);
+        relay.observe(driver.getError(), frame.timestamp);
+    }
+    driver.stop();
+    robot = nullptr;
+    *result = relay.getResult();
+    return relay.isDone();
+}
+
+/*
+ * Tunes the gains with the relay experiment at the top speed, then
+ * reads the track with them at that speed throughout, as on the
+ * robot, from off the line. Returns whether the robot read it
+ * and settled on the line.
+ */
+static bool autoTune(const Track &track, Options options) {
+    options.tuning = AutoTune::atSpeed(options.tuning, options.tuning.maxSpeed);
+    AutoTune::Result result;
+    if (!experiment(options, &result)) {
+        printf("the line ended before %d oscillations\n", AUTOTUNE_SETTLE + AUTOTUNE_CYCLES);
+        return false;
+    }
+    options.tuning = AutoTune::tune(result, options.tuning, options.rule);
+    printf("relay %d: period %.1f ms, amplitude %d\n", result.relay, result.period / 1000.0, result.amplitude);
+    printf("gains: kp %d ki %d kd %d\n", options.tuning.proportional, options.tuning.integral,
+           options.tuning.derivative);
+
+    if (options.offset == 0 && options.angle == 0) {
+        options.offset = 8;
+        options.angle = 10;
+    }
+    const Outcome outcome = simulate(track, options);
+    const bool settled = outcome.swing <= SETTLED_SWING;
+    printf("%s\n", outcome.outcome.c_str());
+    printf("from %.1f mm, %.0f deg: worst offset %.1f mm, swing %.1f mm after %.1f s, %s\n", options.offset,
+           options.angle, outcome.worstOffset, outcome.swing, SETTLE_TIME / 1e6,
+           settled ? "settled" : "not settled");
+    return settled && outcome.outcome.rfind("result", 0) == 0;
+}
+
+/*
+ * Reads the options. Returns false, after saying why, if they are wrong.
+ */
+static bool parse(const int argc, const char *argv[], Options *options) {
+    for (int i = 1; i < argc; i++) {
+        const std::string name = argv[i];
+        if (name == "--sweep") {
+            options->sweep = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            fprintf(stderr, "%s needs a value\n", name.c_str());
+            return false;
+        }
+        const char *value = argv[++i];
+        if (name == "--message") {
+            options->message = value;
+        } else if (name == "--track") {
+            options->trackFile = value;
+        } else if (name == "--write-track") {
+            options->writeTrack = value;
+        } else if (name == "--speed") {
+            options->tuning.baseSpeed = static_cast<int16_t>(atoi(value));
+            options->tuning.maxSpeed = options->tuning.baseSpeed;
+        } else if (name == "--top") {
+            options->tuning.maxSpeed = static_cast<int16_t>(atoi(value));
+        } else if (name == "--kp") {
+            options->tuning.proportional = static_cast<int16_t>(atoi(value));
+        } else if (name == "--kd") {
+            options->tuning.derivative = static_cast<int16_t>(atoi(value));
+        } else if (name == "--ki") {
+            options->tuning.integral = static_cast<int16_t>(atoi(value));
+        } else if (name == "--kff") {
+            options->tuning.feedForward = static_cast<int16_t>(atoi(value));
+        } else if (name == "--dfilter") {
+            options->tuning.derivativeFilter = static_cast<int16_t>(atoi(value));
+        } else if (name == "--narrow") {
+            options->print.narrow = atof(value);
+        } else if (name == "--ratio") {
+            options->print.ratio = atof(value);
+        } else if (name == "--spread") {
+            options->print.spread = atof(value);
+        } else if (name == "--ink") {
+            options->print.ink = static_cast<uint8_t>(atoi(value));
+        } else if (name == "--slant") {
+            options->print.slant = atof(value);
+        } else if (name == "--missing") {
+            options->print.missing = atof(value);
+        } else if (name == "--gap") {
+            options->print.gap = atof(value);
+        } else if (name == "--bend") {
+            options->print.bend = atof(value);
+        } else if (name == "--bend-length") {
+            options->print.bendLength = atof(value);
+        } else if (name == "--lead-in") {
+            options->print.leadIn = atof(value);
+        } else if (name == "--noise") {
+            options->noise = atof(value);
+        } else if (name == "--offset") {
+            options->offset = atof(value);
+        } else if (name == "--angle") {
+            options->angle = atof(value);
+        } else if (name == "--autotune") {
+            options->autoTune = true;
+            if (strcmp(value, "pd") == 0) {
+                options->rule = AutoTune::ZieglerNicholsPd;
+            } else if (strcmp(value, "pid") == 0) {
+                options->rule = AutoTune::ZieglerNicholsPid;
+            } else {
+                fprintf(stderr, "unknown rule %s\n", value);
+                return false;
+            }
+        } else if (name == "--seed") {
+            options->seed = static_cast<uint32_t>(atol(value));
+            options->print.seed = options->seed;
+        } else {
+            fprintf(stderr, "unknown option %s\n", name.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(const int argc, const char *argv[]) {
+    Options options;
+    if (!parse(argc, argv, &options)) {
+        return 2;
+    }
+
+    const double mmPerPixel = 0.5;
+    Track track(1, 1, mmPerPixel);
+    if (options.trackFile != nullptr) {
+        std::string error;
+        if (!Track::load(options.trackFile, mmPerPixel, &track, &error)) {
+            fprintf(stderr, "%s\n", error.c_str());
+            return 2;
+        }
+    } else if (!Track::barcode(options.message, options.print, mmPerPixel, &track)) {
+        fprintf(stderr, "cannot print \"%s\" in Code39\n", options.message.c_str());
+        return 2;
+    }
+    if (options.writeTrack != nullptr && !track.save(options.writeTrack)) {
+        fprintf(stderr, "cannot write %s\n", options.writeTrack);
+        return 2;
+    }
+
+    if (options.sweep) {
+        sweep(track, options);
+        return 0;
+    }
+
+    if (options.autoTune) {
+        return autoTune(track, options) ? 0 : 1;
+    }
+
+    const Outcome outcome = simulate(track, options);
+    printf("%s\n", outcome.outcome.c_str());
+    printf("worst offset %.1f mm, %.2f s simulated in %.4f s (%.0fx real time)\n", outcome.worstOffset,
+           outcome.seconds, outcome.wall, outcome.wall > 0 ? outcome.seconds / outcome.wall : 0);
+    return outcome.outcome.rfind("result", 0) == 0 ? 0 : 1;
+}
@@ -0,0 +1,111 @@
+/**
+ * Trace dump
+ *
+ * Prints a trace captured from the robot's USB serial port (see
+ * Trace.h) as CSV, one line per frame, with notes and dropped
+ * records as comment lines; or, with --frames, as a frame file
+ * (see FrameFile.h) for host/replay.
+ *
+ * Usage: tracedump [--frames] <capture file>
+ *
+ * Date: 2024-11-22
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "FrameFile.h"
+#include "TraceReader.h"
+
+/*
+ * Prints every record as CSV.
+ */
+static void printCsv(TraceReader &reader) {
+    TraceReader::Record record;
+    int run = 0;
+    while (reader.next(&record)) {
+        switch (record.kind) {
+            case TraceReader::Start: {
+                printf("# run %d\n", ++run);
+                printf("run,timestamp,s0,s1,s2,s3,s4,countsLeft,countsRight,motorLeft,motorRight\n");
+                break;
+            }
+            case TraceReader::Frame: {
+                if (record.dropped != 0) {
+                    printf("# %u records dropped\n", record.dropped);
+                }
+                const Trace::Sample &sample = record.sample;
+                printf("%d,%u", run, sample.timestamp);
+                for (const uint16_t value: sample.values) {
+                    printf(",%u", value);
+                }
+                printf(",%d,%d,%d,%d\n", sample.countsLeft, sample.countsRight, sample.motorLeft, sample.motorRight);
+                break;
+            }
+            case TraceReader::Text: {
+                printf("# %s\n", record.text.c_str());
+                break;
+            }
+        }
+    }
+}
+
+/*
+ * Prints every run as a frame file. The robot's notes of how a
+ * run ended are already "result ..." or "error ..." items.
+ */
+static void printFrames(TraceReader &reader) {
+    TraceReader::Record record;
+    FrameFile::Run run = {};
+    bool started = false;
+    while (reader.next(&record)) {
+        switch (record.kind) {
+            case TraceReader::Start: {
+                if (started) {
+                    FrameFile::write(stdout, run);
+                }
+                run = {};
+                started = true;
+                break;
+            }
+            case TraceReader::Frame: {
+                run.dropped += record.dropped;
+                run.frames.push_back(record.sample);
+                break;
+            }
+            case TraceReader::Text: {
+                run.outcome = record.text;
+                break;
+            }
+        }
+    }
+    if (started) {
+        FrameFile::write(stdout, run);
+    }
+}
+
+int main(const int argc, const char *argv[]) {
+    const bool frames = argc == 3 && strcmp(argv[1], "--frames") == 0;
+    if (argc != 2 && !frames) {
+        fprintf(stderr, "usage: %s [--frames] <capture file>\n", argv[0]);
+        return 2;
+    }
+    const char *path = argv[argc - 1];
+    std::vector<uint8_t> bytes;
+    if (!TraceReader::load(path, &bytes)) {
+        fprintf(stderr, "error: cannot read %s\n", path);
+        return 1;
+    }
+
+    TraceReader reader(std::move(bytes));
+    if (frames) {
+        printFrames(reader);
+    } else {
+        printCsv(reader);
+    }
+    if (reader.failed()) {
+        fprintf(stderr, "error: %s\n", reader.error().c_str());
+        return 1;
+    }
+    return 0;
+}
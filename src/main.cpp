@@ -17,9 +17,17 @@
 
 #include "Pololu3piPlus32U4.h"
 #include "Lab4.h"
+#include "AutoTune.h"
+#include "BarcodeReader.h"
+#include "Hal.h"
 #include "LineFollowing.h"
 #include "Parser.h"
+#include "Profiler.h"
 #include "Scanner.h"
+#include "Scheduler.h"
+#include "Sensors.h"
+#include "Settings.h"
+#include "Trace.h"
 
 using namespace LineFollowing;
 using namespace Pololu3piPlus32U4;
@@ -27,15 +35,52 @@ using namespace Parser;
 using namespace Lab4;
 
 OLED display;
+ButtonA buttonA;
 ButtonB buttonB;
+ButtonC buttonC;
 
 LineFollower driver;
-KNNParser parser;
+KNNParser parser(CLASSIFIER_STRATEGY);
 
+// Latest sensor frame, taken once per tick
+SensorFrame frame = {};
 
-bool collectCalibrationBatch();
+// Runs the tasks of every control tick, in this order
+Scheduler scheduler(CONTROL_PERIOD);
 
-bool skipAScan(Scanner &scanner, LineFollower &driver);
+typedef enum {
+    SenseTask,
+    FollowTask,
+    ScanTask,
+    TraceTask,
+    TASK_COUNT,
+} Task;
+
+static const char *const TASK_NAMES[TASK_COUNT] = {"sense", "follow", "scan", "trace"};
+
+// One line of the tuning menu
+typedef struct {
+    const char *name;
+    int16_t Tuning::*field;
+    int16_t step; // change per press of B or C
+    int16_t low;
+    int16_t high;
+} TuningItem;
+
+static const TuningItem TUNING_ITEMS[] = {
+    {"speed", &Tuning::baseSpeed, 10, 0, 400},
+    {"max", &Tuning::maxSpeed, 10, 0, 400},
+    {"kp", &Tuning::proportional, 8, 0, 2048},
+    {"ki", &Tuning::integral, 8, 0, 2048},
+    {"kd", &Tuning::derivative, 32, 0, 4096},
+    {"kff", &Tuning::feedForward, 16, 0, 2048},
+    {"dfilt", &Tuning::derivativeFilter, 1, 0, 6},
+};
+
+static const uint8_t TUNING_ITEM_COUNT = sizeof(TUNING_ITEMS) / sizeof(TUNING_ITEMS[0]);
+
+
+Option<Bar> tick(Scanner &scanner, LineFollower &driver);
 
 void playNote(const String &sequence, bool yield = false);
 
@@ -43,10 +88,28 @@ void displayCentered(const String &message = "EMPTY", uint8_t line = 0);
 
 void displayError(const String &message = "EMPTY");
 
+void displayTiming();
+
+void tuningMenu();
+
+void autoTune();
+
+#if PROFILER_ENABLED
+void displayProfile();
+#endif
+
+void waitForButton();
+
 
 void setup() {
     display.setLayout21x8();
 
+    // Gains last saved from the tuning menu, if any
+    Tuning tuning = DEFAULT_TUNING;
+    if (Settings::load(&tuning)) {
+        driver.setTuning(tuning);
+    }
+
     // Welcome screen
     displayCentered("Abdul Mannan Syed", 0);
     displayCentered("Nathan Gratton", 1);
@@ -59,92 +122,53 @@ void setup() {
     displayCentered("Calibrating...", 4);
     driver.calibrate();
     while (driver.getState() == Calibrating) {
-        driver.follow();
+        driver.follow(frame);
     }
     display.clear();
 }
 
 void loop() {
-    // Ask to start
+    // Ask to start, or to change the gains first
     displayCentered("Ready", 1);
     displayCentered("<  GO  >", 4);
-    buttonB.waitForButton();
+    displayCentered("A: tune  C: auto", 7);
+    while (!buttonB.getSingleDebouncedPress()) {
+        const bool menu = buttonA.getSingleDebouncedPress();
+        const bool automatic = !menu && buttonC.getSingleDebouncedPress();
+        if (menu) {
+            tuningMenu();
+        } else if (automatic) {
+            autoTune();
+        } else {
+            continue;
+        }
+        displayCentered("Ready", 1);
+        displayCentered("<  GO  >", 4);
+        displayCentered("A: tune  C: auto", 7);
+    }
     display.clear();
 
     // Start Scanning Robot
     displayCentered("Scanning", 4);
     playNote(GO_SEQUENCE, true);
     driver.start();
-
-    // Collect first batch
-    if (!collectCalibrationBatch()) {
-        displayError("Line Too Short");
+    scheduler.begin();
+#if PROFILER_ENABLED
+    Profiler::reset();
+#endif
+#if TRACE_ENABLED
+    Trace::begin();
+#endif
+
+    BarcodeReader::Result resultBuffer;
+    const BarcodeReader::Status status = BarcodeReader::read(driver, parser, tick, &resultBuffer);
+    if (status != BarcodeReader::Decoded) {
+        displayError(BarcodeReader::describe(status));
         return;
     }
-
-    // Parse Remaining Characters
-    Buffer<char, 20> resultBuffer;
-    while (resultBuffer.getLast() != CODE39_DELIMITER) {
-        if (resultBuffer.isFull()) {
-            displayError("Max Capacity Reached");
-            return;
-        }
-
-        Buffer<BarType, WIDTH_CHARACTER_SIZE> buffer;
-        Scanner scanner;
-        uint8_t wideBarCount = 0;
-
-        // skip first scan (separator white space)
-        if (!skipAScan(scanner, driver)) {
-            // we ran off-line before we could have started a batch
-            displayError("Missing End Delimiter");
-            return;
-        }
-
-        // collect our 9 values
-        while (!buffer.isFull()) {
-            driver.follow();
-            if (driver.getState() == ReachedEnd) {
-                displayError("Line Too Short");
-                return;
-            }
-
-            Option<Bar> scannedResult = scanner.scan();
-            // add new value we found to buffer
-            if (scannedResult.checkState() == Some) {
-                BarType result = parser.getBarType(scannedResult.getPointer());
-                if (result == Wide) {
-                    playNote(HIGH_SEQUENCE);
-                    wideBarCount++;
-                    if (wideBarCount == 4) {
-                        displayError("Too many wide bars");
-                        return;
-                    }
-                }
-                buffer.add(&result);
-            }
-        }
-
-        // decode our buffer
-        const Option<char> parsedResult = KNNParser::lex(buffer);
-        switch (parsedResult.checkState()) {
-            case Some: {
-                // we found a value!
-                playNote(LOW_SEQUENCE);
-                resultBuffer.add(parsedResult.getValue());
-                break;
-            }
-            case None: {
-                displayError("Invalid Value");
-                return;
-            }
-        }
-    }
     driver.stop();
     display.clear();
     playNote(BEEP_SEQUENCE, true);
-    // Remove last delimiter, and make it a valid c-string
-    resultBuffer.setLast('\0');
 
     // Display Result
     displayCentered("Result:", 0);
@@ -153,92 +177,50 @@ void loop() {
     } else {
         displayCentered(String(resultBuffer.buffer), 4);
     }
-    buttonB.waitForButton();
+#if TRACE_ENABLED
+    Trace::note((String("result ") + resultBuffer.buffer).c_str());
+#endif
+    waitForButton();
     display.clear();
-}
 
-/**
- * Skips a scan value while controlling the driver.
- *
- * This function interacts with the scanner and driver to skip
- * the current scanning process. It may adjust the driver's behavior
- * accordingly.
- *
- * @param scanner Reference to the Scanner object.
- * @param driver Reference to the LineFollower object.
- * @return true if the scan was successfully skipped; false otherwise.
- */
-bool skipAScan(Scanner &scanner, LineFollower &driver) {
-    driver.start();
-    while (scanner.scan().checkState() != Some) {
-        if (driver.getState() == ReachedEnd) {
-            driver.stop();
-            return false;
-        }
-        driver.follow();
-    }
+    displayTiming();
+    waitForButton();
+    display.clear();
 
-    return true;
+#if PROFILER_ENABLED
+    displayProfile();
+    waitForButton();
+    display.clear();
+#endif
 }
 
 /**
- * Collects the first set of barcode values for parser calibration.
- *
- * This function assumes that the initial set of barcode values corresponds
- * to the character '*' in the Code39 character specification.
+ * Runs one control tick.
  *
- * Steps:
- *  1. Collect the first batch of barcode values (Data Collection).
- *  2. Assign hardcoded labels (Data Labelling) to each barcode value,
- *     associating them with the character '*'.
- *  3. Prepare the labeled data for supervised learning.
+ * Waits for the scheduler's next tick, takes the next sensor
+ * frame, if one is ready, and hands that same frame to the
+ * driver, then to the scanner, then to the trace. Each step
+ * is timed as its own task.
  *
- * @returns true if the operation succeeded; false otherwise.
+ * @param scanner Reference to the Scanner object.
+ * @param driver Reference to the LineFollower object.
+ * @return the value found by the scanner; empty if there was no
+ *         new frame or the scanner found nothing new in it.
  */
-bool collectCalibrationBatch() {
-    char starPatternLabel[WIDTH_CHARACTER_SIZE] = CODE39_DELIMITER_PATTERN;
-    Lab4::Buffer<Bar, WIDTH_CHARACTER_SIZE> trainingBatch;
-    auto scanner = Scanner();
-    unsigned int count = 0;
-
-    // Step 1: Collect calibration data
-    // skip first scan
-    if (!skipAScan(scanner, driver)) {
-        return false; // Error
-    }
-
-    // collect data
-    while (!trainingBatch.isFull()) {
-        driver.follow();
-        if (driver.getState() == ReachedEnd) {
-            return false; // Error
-        }
-
-        Option<Bar> scannedResult = scanner.scan();
-        switch (scannedResult.checkState()) {
-            // we found a new value
-            case Some: {
-                Bar result = scannedResult.getValue();
-                // Step 2: label the value
-                const auto type = static_cast<BarType>(starPatternLabel[count]);
-                result.type = type;
-                if (type == Wide) {
-                    playNote(HIGH_SEQUENCE);
-                }
-                trainingBatch.add(&result);
-                count++;
-                break;
-            }
-            // we didn't get a new value
-            case None: {
-                break;
-            }
-        }
+Option<Bar> tick(Scanner &scanner, LineFollower &driver) {
+    scheduler.waitForTick();
+    if (!scheduler.run(SenseTask, [] { return Sensors::acquire(&frame); })) {
+        return {};
     }
-
-    // Step 3: Perform Supervised Learning
-    parser.train(&trainingBatch);
-    return true;
+    scheduler.run(FollowTask, [&driver] { driver.follow(frame); });
+    Option<Bar> result = scheduler.run(ScanTask, [&scanner] { return scanner.scan(frame); });
+#if TRACE_ENABLED
+    scheduler.run(TraceTask, [&driver] {
+        Trace::record(frame, driver.getLeftSpeed(), driver.getRightSpeed());
+        Trace::flush();
+    });
+#endif
+    return result;
 }
 
 /**
@@ -274,10 +256,237 @@ void displayError(const String &message) {
     playNote(BEEP_SEQUENCE, true);
     displayCentered("[ ERROR ]", 0);
     displayCentered(message, 1);
-    buttonB.waitForButton();
+#if TRACE_ENABLED
+    Trace::note((String("error ") + message).c_str());
+#endif
+    waitForButton();
+    display.clear();
+}
+
+/**
+ * Displays the execution times of the control tasks.
+ *
+ * One line per task with its minimum, mean and maximum time in
+ * microseconds, followed by how many tasks overran their tick
+ * and how many ticks were missed over the run.
+ */
+void displayTiming() {
+    char line[22];
+    uint16_t overruns = 0;
+
+    displayCentered("Timing (us)", 0);
+    display.gotoXY(0, 2);
+    display.print("task   min mean  max");
+    for (uint8_t task = 0; task < TASK_COUNT; task++) {
+        const Scheduler::TaskStats &stats = scheduler.getStats(task);
+        snprintf(line, sizeof(line), "%-6s%4u %4u %4u",
+                 TASK_NAMES[task],
+                 stats.runs == 0 ? 0 : Scheduler::toMicros(stats.min),
+                 Scheduler::toMicros(stats.mean()),
+                 Scheduler::toMicros(stats.max));
+        display.gotoXY(0, 3 + task);
+        display.print(line);
+        overruns += stats.overruns;
+    }
+    snprintf(line, sizeof(line), "overrun %u missed %u", overruns, scheduler.getMissedTicks());
+    display.gotoXY(0, 7);
+    display.print(line);
+}
+
+#if PROFILER_ENABLED
+/**
+ * Displays the profiled sections of the run.
+ *
+ * One line per section with how often it ran and its mean and
+ * maximum time in CPU cycles. The same numbers, with the minimum,
+ * also go to the trace.
+ */
+void displayProfile() {
+    char line[22];
+
+    display.gotoXY(0, 0);
+    display.print("cycles     n mean max");
+    for (uint8_t section = 0; section < Profiler::SECTION_COUNT; section++) {
+        const Profiler::SectionStats &stats = Profiler::getStats(static_cast<Profiler::Section>(section));
+        const uint32_t mean = stats.count == 0 ? 0 : stats.total / stats.count;
+        snprintf(line, sizeof(line), "%-6s%5u%5lu%5lu",
+                 Profiler::name(static_cast<Profiler::Section>(section)),
+                 stats.count,
+                 static_cast<unsigned long>(Profiler::toCycles(mean)),
+                 static_cast<unsigned long>(Profiler::toCycles(stats.max)));
+        display.gotoXY(0, 1 + section);
+        display.print(line);
+    }
+    Profiler::dump();
+}
+#endif
+
+/**
+ * Lets the speeds and gains be changed with the buttons.
+ *
+ * One line per setting and a last line to leave. A moves to the
+ * next line, C raises the setting and B lowers it, within its
+ * limits. On the last line, B or C applies the tuning to the
+ * driver and saves it to EEPROM (see Settings.h).
+ */
+void tuningMenu() {
+    Tuning tuning = driver.getTuning();
+    uint8_t item = 0;
+    char line[22];
+
+    for (;;) {
+        display.clear();
+        for (uint8_t i = 0; i < TUNING_ITEM_COUNT; i++) {
+            snprintf(line, sizeof(line), "%c%-6s%6d", i == item ? '>' : ' ', TUNING_ITEMS[i].name,
+                     tuning.*TUNING_ITEMS[i].field);
+            display.gotoXY(0, i);
+            display.print(line);
+        }
+        display.gotoXY(0, TUNING_ITEM_COUNT);
+        display.print(item == TUNING_ITEM_COUNT ? ">save" : " save");
+
+        int8_t change = 0;
+        for (;;) {
+            if (buttonA.getSingleDebouncedPress()) {
+                break;
+            }
+            if (buttonB.getSingleDebouncedPress()) {
+                change = -1;
+                break;
+            }
+            if (buttonC.getSingleDebouncedPress()) {
+                change = 1;
+                break;
+            }
+        }
+
+        if (change == 0) {
+            item = (item + 1) % (TUNING_ITEM_COUNT + 1);
+        } else if (item == TUNING_ITEM_COUNT) {
+            break;
+        } else {
+            const TuningItem &entry = TUNING_ITEMS[item];
+            const int16_t value = tuning.*entry.field + change * entry.step;
+            tuning.*entry.field = constrain(value, entry.low, entry.high);
+        }
+    }
+
+    driver.setTuning(tuning);
+    Settings::save(tuning);
+    display.clear();
+}
+
+/**
+ * Tunes the gains for a speed on the line (see AutoTune.h).
+ *
+ * First asks for the speed to tune for, from the top speed: C
+ * raises it and B lowers it, A starts. The robot then weaves
+ * along the line under the relay at that speed until enough
+ * oscillations have been measured, then stops and shows what it
+ * measured and the gains it gives. B applies and saves them, with
+ * the speed as both the base and the top speed, as the gains only
+ * hold for the loop they were found on; A throws them away. The line must be
+ * long enough for AUTOTUNE_SETTLE + AUTOTUNE_CYCLES oscillations
+ * at that speed.
+ */
+void autoTune() {
+    char line[22];
+    const Tuning previous = driver.getTuning();
+    int16_t speed = previous.maxSpeed;
+    for (;;) {
+        display.clear();
+        displayCentered("Auto-tune for", 1);
+        snprintf(line, sizeof(line), "speed %d", speed);
+        displayCentered(line, 4);
+        displayCentered("B: -  A: go  C: +", 7);
+
+        int8_t change = 0;
+        while (change == 0) {
+            if (buttonA.getSingleDebouncedPress()) {
+                break;
+            }
+            if (buttonB.getSingleDebouncedPress()) {
+                change = -1;
+            } else if (buttonC.getSingleDebouncedPress()) {
+                change = 1;
+            }
+        }
+        if (change == 0) {
+            break;
+        }
+        speed = constrain(speed + change * 10, 10, 400);
+    }
+
+    display.clear();
+    displayCentered("Auto-tune", 4);
+    playNote(GO_SEQUENCE, true);
+
+    const Tuning relayTuning = AutoTune::atSpeed(previous, speed);
+    AutoTune::RelayExperiment experiment(AutoTune::relayFor(relayTuning));
+    driver.setTuning(relayTuning);
+    driver.setRelay(AutoTune::relayFor(relayTuning));
+    driver.start();
+    scheduler.begin();
+    while (!experiment.isDone() && driver.getState() == Following) {
+        scheduler.waitForTick();
+        if (!Sensors::acquire(&frame)) {
+            continue;
+        }
+        driver.follow(frame);
+        experiment.observe(driver.getError(), frame.timestamp);
+    }
+    driver.setRelay(0);
+    driver.setTuning(previous);
+    if (!experiment.isDone()) {
+        displayError("Line Too Short");
+        return;
+    }
+    driver.stop();
+    display.clear();
+
+    const AutoTune::Result result = experiment.getResult();
+    const Tuning tuned = AutoTune::tune(result, relayTuning, AUTOTUNE_RULE);
+    snprintf(line, sizeof(line), "Tu %5lu ms a %4d", static_cast<unsigned long>(result.period / 1000),
+             result.amplitude);
+    display.gotoXY(0, 0);
+    display.print(line);
+    snprintf(line, sizeof(line), "kp %d ki %d kd %d", tuned.proportional, tuned.integral, tuned.derivative);
+    display.gotoXY(0, 2);
+    display.print(line);
+    displayCentered("B: save  A: drop", 7);
+#if TRACE_ENABLED
+    Trace::note(line);
+#endif
+
+    for (;;) {
+        if (buttonA.getSingleDebouncedPress()) {
+            break;
+        }
+        if (buttonB.getSingleDebouncedPress()) {
+            driver.setTuning(tuned);
+            Settings::save(tuned);
+            break;
+        }
+    }
     display.clear();
 }
 
+/**
+ * Waits for button B to be pressed.
+ *
+ * While waiting, whatever is left of the run's trace is sent,
+ * so it is complete by the time the next run starts.
+ */
+void waitForButton() {
+#if TRACE_ENABLED
+    while (!buttonB.getSingleDebouncedPress()) {
+        Trace::flush();
+    }
+#else
+    buttonB.waitForButton();
+#endif
+}
+
 /**
  * Plays a specified musical note sequence.
  *
@@ -290,10 +499,12 @@ void displayError(const String &message) {
  *              finished playing if set to true
  */
 void playNote(const String &sequence, const bool yield) {
-    Buzzer::stopPlaying(); // stop all previous
-    Buzzer::play(sequence.c_str());
+    {
+        PROFILE(PlayNote);
+        Hal::Buzzer::play(sequence.c_str()); // stops all previous
+    }
     if (yield) {
-        while (Buzzer::isPlaying()) {
+        while (Hal::Buzzer::isPlaying()) {
         }
     }
 }